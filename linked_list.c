@@ -2,6 +2,7 @@
 #include "linked_list.h"
 
 pthread_rwlock_t rwLock;
+mem_cache_t *nodeCache;
 
 /**
  * Initializes the linked list.
@@ -10,6 +11,7 @@ pthread_rwlock_t rwLock;
  */
 void list_init(Node **head, size_t size) {
     mem_init(size);
+    nodeCache = mem_cache_create(sizeof(Node), _Alignof(Node));
     *head = NULL;
     pthread_rwlock_init(&rwLock, NULL);
 }
@@ -22,7 +24,7 @@ void list_init(Node **head, size_t size) {
  */
 void list_insert(Node **head, uint16_t data) {
     pthread_rwlock_wrlock(&rwLock);
-    Node *newNode = (Node *)mem_alloc(sizeof(Node));
+    Node *newNode = (Node *)mem_cache_alloc(nodeCache);
     if (newNode == NULL) {
         printf_red("Memory allocation failed in insert()\n");
         pthread_rwlock_unlock(&rwLock);
@@ -57,7 +59,7 @@ void list_insert_after(Node *prevNode, uint16_t data) {
         printf_red("Previous node cannot be NULL\n");
         return;
     }
-    Node *newNode = (Node *)mem_alloc(sizeof(Node));
+    Node *newNode = (Node *)mem_cache_alloc(nodeCache);
     if (newNode == NULL) {
         printf_red("Memory allocation failed\n");
         return;
@@ -82,9 +84,9 @@ void list_insert_before(Node **head, Node *nextNode, uint16_t data) {
         printf_red("Previous node cannot be NULL\n");
         return;
     }
-    Node *newNode = (Node *)mem_alloc(sizeof(Node));
+    Node *newNode = (Node *)mem_cache_alloc(nodeCache);
     if (newNode == NULL) {
-        printf_red("%s,%d Memory allocation failed in mem_alloc()\n", __FILE__, __LINE__);
+        printf_red("%s,%d Memory allocation failed in mem_cache_alloc()\n", __FILE__, __LINE__);
         return;
     }
     newNode->data = data;
@@ -122,7 +124,7 @@ void list_delete(Node **head, uint16_t data) {
 
     if (temp != NULL && temp->data == data) {
         *head = temp->next;
-        mem_free(temp);
+        mem_cache_free(nodeCache, temp);
         pthread_rwlock_unlock(&rwLock);
         return;
     }
@@ -137,7 +139,7 @@ void list_delete(Node **head, uint16_t data) {
         return;
     }
     prev->next = temp->next;
-    mem_free(temp);
+    mem_cache_free(nodeCache, temp);
     pthread_rwlock_unlock(&rwLock);
 }
 
@@ -234,10 +236,12 @@ void list_cleanup(Node **head) {
     Node *next;
     while (current != NULL) {
         next = current->next;
-        mem_free(current);
+        mem_cache_free(nodeCache, current);
         current = next;
     }
     *head = NULL;
+    mem_cache_destroy(nodeCache);
+    nodeCache = NULL;
     mem_deinit();
     pthread_rwlock_destroy(&rwLock);
 }
@@ -1,234 +1,5043 @@
+#define _GNU_SOURCE
 #include "memory_manager.h"
 
+#include <sched.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// With restartable sequences registered by the C library, the kernel keeps
+// the current CPU in a per-thread area and sched_getcpu is a plain load.
+#if defined(__has_include)
+#if __has_include(<sys/rseq.h>)
+#include <sys/rseq.h>
+#define HAVE_RSEQ 1
+#endif
+#endif
+
+// NUMA pools bind each arena to its node with the mbind system call, so no
+// NUMA library is needed. A node mask covers up to NUMA_NODES_MAX nodes.
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+#define NUMA_NODES_MAX 1024
+
+// Requests of up to SIZE_CLASS_MAX bytes are served from per-class free lists
+// before falling back to the gap walk. Classes are spaced one byte apart so a
+// recycled block always fits its request exactly and the pool never loses
+// capacity to rounding.
+#define SIZE_CLASS_MAX 256
+
+// Block records are carved from chunks of NODE_CHUNK_SIZE records owned by the
+// manager, so the allocation hot path never calls into libc malloc.
+#define NODE_CHUNK_SIZE 256
+
+// Initial number of slots in the block index. The index doubles whenever it
+// becomes three quarters full.
+#define INDEX_MIN_CAPACITY 64
+
+// Lock-free readers that find a change to the index in progress pause between
+// checks, and yield the CPU after INDEX_SPIN_MAX checks in case the writer has
+// been preempted
+#define INDEX_SPIN_MAX 64
+
+// The TLSF engine keeps free blocks in TLSF_SL_COUNT lists per power of two,
+// with one bitmap bit per list so a fitting list is found with two bit scans.
+#define TLSF_SL_LOG2 5
+#define TLSF_SL_COUNT (1 << TLSF_SL_LOG2)
+#define TLSF_FL_COUNT (64 - TLSF_SL_LOG2 + 1)
+
+// When every list above a request's rounded size is empty, at most
+// TLSF_FIT_PROBES blocks of the request's own list are checked before the
+// allocation fails, so a request never walks a list of unbounded length
+#define TLSF_FIT_PROBES 4
+
+// The buddy engine never hands out blocks smaller than BUDDY_MIN_SIZE, so a
+// free block can always hold its own free-list links.
+#define BUDDY_MIN_ORDER 4
+#define BUDDY_MIN_SIZE (1 << BUDDY_MIN_ORDER)
+
+// Blocks bumped off the untouched tail of an arena are rounded up to a
+// multiple of BUMP_UNIT bytes, or of the engine granule if that is larger,
+// and the tail keeps one end mark per unit. The marks then cost one bit per
+// BUMP_UNIT bytes bumped rather than one per byte with a granule of 1. Tiny
+// slots are multiples of the unit too, so a run on the tail splits into its
+// slots.
+#define BUMP_UNIT TINY_STEP
+
+// Object caches carve slabs of up to SLAB_MAX_OBJECTS objects out of the pool
+#define SLAB_MAX_OBJECTS 64
+
+// Regions take chunks of REGION_CHUNK_SIZE bytes from the pool, or of the
+// size asked for when they begin, and bump their blocks off the current one
+#define REGION_CHUNK_SIZE (16UL << 10)
+
+// Pools backed by huge pages are mapped at a multiple of HUGE_PAGE_SIZE, so
+// the first huge page starts at the pool's base.
+#define HUGE_PAGE_SIZE (2UL << 20)
+
+// Pools from the default pages are reserved without access and committed in
+// steps of COMMIT_CHUNK bytes as the untouched tail of each arena is used up,
+// so pool capacity that is never reached costs neither time nor memory.
+#define COMMIT_CHUNK (1UL << 20)
+
+// A pool with a ceiling above its size grows by up to POOL_CHUNK_MAX chunks,
+// each mapped on its own and managed as one more arena. Every chunk starts
+// with a guard page that is never used, so the end of the pool or of another
+// chunk is never the start of a block.
+#define POOL_CHUNK_MAX 64
+
+// Handle records are carved from chunks of HANDLE_CHUNK_SIZE records. A lock
+// count of HANDLE_MOVING marks a block that compaction is moving.
+#define HANDLE_CHUNK_SIZE 256
+#define HANDLE_MOVING -1
+
+// Requests of up to TINY_MAX bytes are rounded up to a multiple of TINY_STEP
+// and served from runs of up to 64 equal slots. A run is one block of the
+// arena, and its slots are tracked by a single bitmap word instead of a record
+// per block. Free slots are holes nothing else can use, so a run takes at most
+// 1/TINY_RUN_SHARE of its arena, and runs are turned back into ordinary
+// blocks when an allocation fails. Runs that would hold fewer than
+// TINY_RUN_MIN slots are not made; such requests are placed exactly instead.
+#define TINY_STEP 8
+#define TINY_MAX 64
+#define TINY_CLASSES (TINY_MAX / TINY_STEP)
+#define TINY_RUN_MIN 4
+#define TINY_RUN_SHARE 64
+#define RUN_CHUNK_SIZE 64
+
+// Every thread keeps up to TCACHE_BIN_MAX freed blocks of each size from
+// TCACHE_MIN_SIZE to TCACHE_MAX_SIZE bytes and hands them out again without
+// taking an arena lock. Bins hold one exact size each, linked through the
+// blocks.
+#define TCACHE_MIN_SIZE sizeof(void*)
+#define TCACHE_MAX_SIZE 256
+#define TCACHE_BIN_MAX 16
+
+// Every block owns one record describing the range [start, end) of the pool.
+// Records are kept outside the pool so that a pool of n bytes can hold exactly
+// n bytes of payload, and are doubly linked in address order so the blocks on
+// either side of any block are reachable in O(1).
 typedef struct Node {
     void* start;
     void* end;
+    struct Node* prev;
     struct Node* next;
+    struct Node* nextFree;  // Next block in the same free list while free
+    struct Node* prevFree;  // Previous block in the same TLSF free list
+    struct Node* gapLeft;   // Children in the list engine's gap tree
+    struct Node* gapRight;
+    size_t gapSize;         // Size of the gap after the block, 0 if untracked
+    int gapHeight;
+    struct Node* addrLeft;  // Children in the list engine's gap address tree
+    struct Node* addrRight;
+    size_t addrMax;         // Largest gap in the address subtree
+    int addrHeight;
+    bool free;              // Not handed out; parked or in a free list
 } Node;
 
-void* memoryPool = NULL;
-size_t memorySize = 0;
-Node* head = NULL;
-pthread_mutex_t mLock;
+typedef struct NodeChunk {
+    struct NodeChunk* next;
+    Node nodes[NODE_CHUNK_SIZE];
+} NodeChunk;
+
+// An allocation engine decides where blocks are placed in an arena. Every
+// operation is called with the arena's lock held. An engine starts out owning
+// none of its arena. The committed part of the arena is handed to it through
+// adopt once the untouched tail has been used up, and the rest is handed over
+// in commit chunks as the engine runs out of room.
+typedef struct Arena Arena;
+typedef struct Engine {
+    size_t granule;  // Block sizes are rounded up to a multiple of this
+    bool (*init)(Arena* a);
+    void (*deinit)(Arena* a);
+    void* (*alloc)(Arena* a, size_t size);
+    void (*free)(Arena* a, Node* node);
+    void* (*resize)(Arena* a, Node* node, size_t size);
+    bool (*adopt)(Arena* a, void* start, void* end, bool used);
+    bool (*split)(Arena* a, Node* node, size_t size);
+    size_t (*purge)(Arena* a);
+} Engine;
+
+// A cache of same-size objects. Free objects are kept on a singly linked list
+// whose links are stored in the objects themselves.
+struct mem_cache {
+    mm_pool_t* pool;  // The pool slabs are taken from
+    size_t objectSize;  // Object size rounded up to the alignment
+    size_t align;
+    void* freeObjects;
+    void** slabs;  // Every slab taken from the pool, freed on destroy
+    size_t slabCount;
+    size_t slabCapacity;
+    pthread_mutex_t lock;
+};
+
+// A chunk of a region, taken from the pool as one block
+typedef struct RegionChunk {
+    void* base;
+    size_t size;
+} RegionChunk;
+
+// A bump allocator over chunks taken from a pool. Blocks are never freed one
+// by one; resetting to a mark moves the bump position back, and chunks past
+// it are kept for reuse until the region ends.
+struct mem_region {
+    mm_pool_t* pool;
+    size_t chunkSize;  // Bytes taken from the pool for a new chunk
+    size_t align;  // Every block starts at a multiple of this
+    RegionChunk* chunks;
+    size_t chunkCount;
+    size_t chunkCapacity;
+    size_t current;  // Index of the chunk blocks are bumped off
+    size_t offset;  // Bytes used in the current chunk
+};
+
+// A relocatable block. While its lock count is zero, compaction may move the
+// block and update the handle. Unused records are linked through nextFree.
+struct mem_handle {
+    mm_pool_t* pool;
+    void* block;  // NULL while the record is unused
+    atomic_int locks;
+    struct mem_handle* nextFree;
+};
+
+typedef struct HandleChunk {
+    struct HandleChunk* next;
+    mem_handle_t handles[HANDLE_CHUNK_SIZE];
+} HandleChunk;
+
+// The cache of freed blocks owned by one thread, or by one CPU with per-CPU
+// locked caches. The owner and threads flushing every cache after a failed
+// allocation serialize on its lock, which is otherwise uncontended; a CPU's
+// cache is only shared when a thread is preempted or migrated while using it.
+typedef struct ThreadCache {
+    mm_pool_t* pool;
+    void* bins[TCACHE_MAX_SIZE + 1];
+    unsigned char counts[TCACHE_MAX_SIZE + 1];
+    struct ThreadCache* prev;
+    struct ThreadCache* next;
+    pthread_mutex_t lock;
+} ThreadCache;
+
+// An index table or run map replaced by a larger one. Lock-free readers may
+// still be probing it, so it is kept until mem_deinit.
+typedef struct RetiredTable {
+    struct RetiredTable* next;
+    void* table;
+} RetiredTable;
+
+// A run of equal slots for tiny requests. Its records are kept outside the
+// pool and reused through a free list, like block records.
+typedef struct Run {
+    void* start;
+    void* end;
+    size_t slotSize;
+    uint64_t freeSlots;  // Bit i is set while slot i is free
+    uint64_t allSlots;   // The value of freeSlots when the run is empty
+    struct Run* prev;    // Neighbours in the list of runs with free slots
+    struct Run* next;
+} Run;
+
+typedef struct RunChunk {
+    struct RunChunk* next;
+    Run runs[RUN_CHUNK_SIZE];
+} RunChunk;
+
+// Free-list links of a free buddy block, stored in the block itself
+typedef struct BuddyBlock {
+    struct BuddyBlock* next;
+    struct BuddyBlock* prev;
+} BuddyBlock;
+
+// An arena is an independently locked slice of the pool. It has its own block
+// records, index and engine state, so threads working in different arenas
+// never contend.
+struct Arena {
+    mm_pool_t* pool;  // The pool the arena belongs to
+    void* base;
+    size_t size;
+    pthread_mutex_t lock;
+
+    // Untouched tail state. Until the tail is absorbed by the engine, blocks
+    // are bumped off [bumpTop, bumpLimit) without taking the lock, and the
+    // last unit of every bumped block is marked in bumpEnds.
+    atomic_size_t bumpTop;
+    atomic_size_t bumpCommitted;  // Bytes bumped whose end mark is visible
+    atomic_bool bumpAbsorbed;
+    size_t bumpLimit;
+    int bumpShift;  // log2 of the bump unit
+    uint64_t* bumpEnds;
+    size_t bumpEndsSize;  // Bytes mapped for bumpEnds
+    void** bumpFreed;  // Bumped blocks freed before the tail was absorbed
+    size_t bumpFreedCount;
+    size_t bumpFreedCapacity;
+    atomic_size_t committed;  // Bytes from the base that may be touched
+    size_t engineLimit;  // Bytes from the base handed to the engine
+
+    size_t trimPending;  // Bytes freed since the arena was last trimmed
+
+    // Blocks freed by threads that did not take the lock, linked through
+    // their first word. Any thread pushes; only the lock holder drains.
+    _Atomic(void*) remoteFree;
+
+    Node* head;
+    Node* tail;
+    Node* rover;  // The last block placed, where a next-fit walk resumes
+    Node* gapRoot;  // AVL tree of the gaps after list nodes by size, address
+    Node* addrRoot;  // AVL tree of the same gaps by address, with maxima
+    size_t gapBytes;  // Sum of the gaps in the gap tree
+    Node* sizeClasses[SIZE_CLASS_MAX + 1];
+    NodeChunk* nodeChunks;
+    Node* freeNodes;
+    size_t freeNodeCount;
+    Node** blockIndex;  // Open-addressing table of records keyed by start
+    size_t indexCapacity;
+    size_t indexCount;
+    atomic_uint indexSeq;  // Odd while the index or run map is being changed
+    RetiredTable* retiredTables;
+
+    // Tiny block state. The run map holds every run sorted by address, so the
+    // run holding a slot is found with a binary search.
+    Run* tinyRuns[TINY_CLASSES];  // Runs with free slots, per slot size
+    Run** runMap;
+    size_t runMapCount;
+    size_t runMapCapacity;
+    RunChunk* runChunks;
+    Run* freeRuns;
+
+    // TLSF engine state
+    uint64_t tlsfFlBitmap;
+    uint32_t tlsfSlBitmap[TLSF_FL_COUNT];
+    Node* tlsfBlocks[TLSF_FL_COUNT][TLSF_SL_COUNT];
+
+    // Buddy engine state. Bit i of buddyBitmaps[k] is set while the block of
+    // order k at offset i << k is free.
+    BuddyBlock* buddyFree[64];
+    uint64_t buddyOrderMask;  // Bit k is set while buddyFree[k] is not empty
+    uint64_t* buddyBitmaps[64];
+    uint64_t* buddyBitmapStore;
+    size_t buddyBitmapSize;  // Bytes mapped for buddyBitmapStore
+    size_t buddyLimit;  // Usable bytes, the arena size rounded down
+    int buddyMaxOrder;
+};
+
+// A pool and everything that manages it. Pools share nothing, so each one is
+// a separate contention domain. The mem_* functions use defaultPool.
+struct mm_pool {
+    void* memoryPool;
+    size_t memorySize;
+    size_t poolMapSize;  // Size of the pool's mapping, 0 if it came from malloc
+    size_t poolPageSize;  // Size of the pages backing the pool
+    bool poolReserved;  // The pool must be committed before it is used
+    size_t trimThreshold;  // Bytes freed in an arena before it is trimmed
+    size_t align;  // Every block starts at a multiple of this, a power of two
+    const Engine* engine;
+    _Atomic mem_policy_t policy;
+    Arena* arenas;
+    size_t arenaCount;
+    size_t arenaSpan;  // Size of every arena but the last, which gets the rest
+
+    // Growth state, changed under growLock. A chunk's arena is published by
+    // incrementing chunkCount once it is ready.
+    Arena* chunkArenas[POOL_CHUNK_MAX];
+    atomic_size_t chunkCount;
+    size_t poolCeiling;  // Size the pool may grow to, at most memorySize if 0
+    size_t grownSize;  // Bytes added by chunks
+    pthread_mutex_t growLock;
+
+    // Handle state, protected by handleLock. Compaction holds it throughout,
+    // so handles are not created or freed while blocks are being moved.
+    HandleChunk* handleChunks;
+    mem_handle_t* freeHandles;
+    size_t handleCount;
+    pthread_mutex_t handleLock;
+
+    // Thread cache state. The list of caches is protected by tcacheLock.
+    pthread_key_t tcacheKey;
+    bool tcacheEnabled;
+    ThreadCache* tcaches;
+    pthread_mutex_t tcacheLock;
+    ThreadCache* cpuCaches;  // One locked cache per CPU, not per thread
+    size_t cpuCount;
+
+    size_t numaNodes;  // Arena i is bound to node i, 0 if arenas are not bound
+    bool engineOnly;  // No tails, runs or caches; the engine places every block
+};
+
+mm_pool_t defaultPool;
+size_t pageSize = 4096;  // Size of the system's pages
+_Atomic mem_policy_t defaultPolicy = MEM_POLICY_FIRST_FIT;  // For new pools
+atomic_size_t nextArena = 0;
+static __thread size_t threadArena = 0;  // One past the thread's arena, or 0
+
+/**
+ * Sets the start of a block record. Lock-free size lookups may read any
+ * record while the arena lock holder changes it, so the extent and state of
+ * a record are only ever stored atomically.
+ */
+static void node_set_start(Node* node, void* start) {
+    __atomic_store_n(&node->start, start, __ATOMIC_RELAXED);
+}
+
+/**
+ * Sets the end of a block record. See node_set_start.
+ */
+static void node_set_end(Node* node, void* end) {
+    __atomic_store_n(&node->end, end, __ATOMIC_RELAXED);
+}
+
+/**
+ * Marks a block record free or allocated. See node_set_start.
+ */
+static void node_set_free(Node* node, bool free) {
+    __atomic_store_n(&node->free, free, __ATOMIC_RELAXED);
+}
+
+/**
+ * Adds chunks of records to the record free list until it holds at least the
+ * given number of records.
+ *
+ * @param a The arena.
+ * @param count The number of records needed.
+ * @return true on success, false if a chunk could not be added.
+ */
+static bool node_reserve(Arena* a, size_t count) {
+    while (a->freeNodeCount < count) {
+        NodeChunk* chunk = malloc(sizeof(NodeChunk));
+        if (!chunk) return false;
+        chunk->next = a->nodeChunks;
+        a->nodeChunks = chunk;
+        for (int i = NODE_CHUNK_SIZE - 1; i >= 0; i--) {
+            chunk->nodes[i].next = a->freeNodes;
+            a->freeNodes = &chunk->nodes[i];
+        }
+        a->freeNodeCount += NODE_CHUNK_SIZE;
+    }
+    return true;
+}
+
+/**
+ * Takes a block record from the record free list, adding a new chunk of
+ * records when the list is empty.
+ *
+ * @param a The arena.
+ * @return A pointer to an unused record, or NULL if no chunk could be added.
+ */
+static Node* node_alloc(Arena* a) {
+    if (!node_reserve(a, 1)) return NULL;
+
+    Node* node = a->freeNodes;
+    a->freeNodes = node->next;
+    a->freeNodeCount--;
+    node->nextFree = NULL;
+    node->gapSize = 0;
+    node_set_free(node, false);
+    return node;
+}
+
+/**
+ * Returns a block record to the record free list.
+ *
+ * @param a The arena.
+ * @param node The record to release.
+ */
+static void node_release(Arena* a, Node* node) {
+    node->next = a->freeNodes;
+    a->freeNodes = node;
+    a->freeNodeCount++;
+}
+
+/**
+ * Hashes a block start address into the block index.
+ *
+ * @param addr The start address of a block.
+ * @return The hash of the address.
+ */
+static size_t index_hash(void* addr) {
+    uint64_t x = (uintptr_t)addr;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return (size_t)x;
+}
+
+/**
+ * Finds the record of the block starting at the given address.
+ *
+ * @param a The arena.
+ * @param addr The start address of the block.
+ * @return The block record, or NULL if no block starts at addr.
+ */
+static Node* index_find(Arena* a, void* addr) {
+    if (a->indexCount == 0) return NULL;
+
+    size_t mask = a->indexCapacity - 1;
+    for (size_t i = index_hash(addr) & mask; a->blockIndex[i] != NULL;
+         i = (i + 1) & mask) {
+        if (a->blockIndex[i]->start == addr) return a->blockIndex[i];
+    }
+    return NULL;
+}
+
+/**
+ * Marks the start of a change to the block index. Lock-free readers that
+ * overlap the change see an odd or changed sequence number and retry.
+ *
+ * @param a The arena.
+ */
+static void index_write_begin(Arena* a) {
+    unsigned seq = atomic_load_explicit(&a->indexSeq, memory_order_relaxed);
+    atomic_store_explicit(&a->indexSeq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+/**
+ * Marks the end of a change to the block index.
+ *
+ * @param a The arena.
+ */
+static void index_write_end(Arena* a) {
+    unsigned seq = atomic_load_explicit(&a->indexSeq, memory_order_relaxed);
+    atomic_store_explicit(&a->indexSeq, seq + 1, memory_order_release);
+}
+
+/**
+ * Waits until no change to the block index or run map is in progress.
+ * Readers pause between checks and yield the CPU once they have spun for a
+ * while, so they do not burn the timeslice of a preempted writer.
+ *
+ * @param a The arena.
+ * @return The even sequence number to check the read against afterwards.
+ */
+static unsigned index_read_begin(Arena* a) {
+    for (unsigned spins = 0;; spins++) {
+        unsigned seq = atomic_load_explicit(&a->indexSeq, memory_order_acquire);
+        if (!(seq & 1)) return seq;
+        if (spins >= INDEX_SPIN_MAX) {
+            sched_yield();
+        } else {
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#elif defined(__aarch64__)
+            __asm__ volatile("yield");
+#endif
+        }
+    }
+}
+
+/**
+ * Looks up the size of an allocated block without taking the arena lock.
+ * Records and retired index tables stay mapped until mem_deinit, so a lookup
+ * racing with a change only ever reads stale data, which the sequence check
+ * then rejects.
+ *
+ * @param a The arena.
+ * @param addr The start address of the block.
+ * @param size Set to the size of the block on success.
+ * @return true if an allocated block starts at addr.
+ */
+static bool index_lookup_size(Arena* a, void* addr, size_t* size) {
+    for (;;) {
+        unsigned seq = index_read_begin(a);
+
+        size_t capacity = __atomic_load_n(&a->indexCapacity, __ATOMIC_ACQUIRE);
+        Node** table = __atomic_load_n(&a->blockIndex, __ATOMIC_ACQUIRE);
+        Node* found = NULL;
+        if (table != NULL) {
+            size_t mask = capacity - 1;
+            size_t i = index_hash(addr) & mask;
+            for (size_t probes = 0; probes < capacity; probes++) {
+                Node* node = __atomic_load_n(&table[i], __ATOMIC_RELAXED);
+                if (node == NULL) break;
+                if (__atomic_load_n(&node->start, __ATOMIC_RELAXED) == addr) {
+                    found = node;
+                    break;
+                }
+                i = (i + 1) & mask;
+            }
+        }
+
+        size_t bytes = 0;
+        bool allocated = false;
+        if (found != NULL) {
+            bytes = __atomic_load_n(&found->end, __ATOMIC_RELAXED) - addr;
+            allocated = !__atomic_load_n(&found->free, __ATOMIC_RELAXED);
+        }
+
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&a->indexSeq, memory_order_relaxed) != seq) {
+            continue;
+        }
+        if (!allocated) return false;
+        *size = bytes;
+        return true;
+    }
+}
+
+/**
+ * Grows the index table, if needed, so the given number of records can be
+ * added without growing it again.
+ *
+ * @param a The arena.
+ * @param count The number of records to make room for.
+ * @return true on success, false if the table could not be grown.
+ */
+static bool index_reserve(Arena* a, size_t count) {
+    size_t capacity =
+        a->indexCapacity ? a->indexCapacity : INDEX_MIN_CAPACITY;
+    while ((a->indexCount + count) * 4 > capacity * 3) capacity *= 2;
+    if (capacity != a->indexCapacity) {
+        Node** table = calloc(capacity, sizeof(Node*));
+        if (!table) return false;
+        RetiredTable* retired = NULL;
+        if (a->blockIndex) {
+            retired = malloc(sizeof(RetiredTable));
+            if (!retired) {
+                free(table);
+                return false;
+            }
+        }
+
+        for (size_t i = 0; i < a->indexCapacity; i++) {
+            if (a->blockIndex[i] == NULL) continue;
+            size_t j = index_hash(a->blockIndex[i]->start) & (capacity - 1);
+            while (table[j] != NULL) j = (j + 1) & (capacity - 1);
+            table[j] = a->blockIndex[i];
+        }
+        if (retired) {
+            retired->table = a->blockIndex;
+            retired->next = a->retiredTables;
+            a->retiredTables = retired;
+        }
+
+        // Readers load the capacity before the table, so publishing the table
+        // first means no reader pairs a capacity with a smaller table. The
+        // release makes its entries visible to a reader that sees it.
+        index_write_begin(a);
+        __atomic_store_n(&a->blockIndex, table, __ATOMIC_RELEASE);
+        __atomic_store_n(&a->indexCapacity, capacity, __ATOMIC_RELEASE);
+        index_write_end(a);
+    }
+    return true;
+}
+
+/**
+ * Adds a block record to the index, growing the table if it is getting full.
+ *
+ * @param a The arena.
+ * @param node The record to add. No other indexed block may share its start.
+ * @return true on success, false if the table could not be grown.
+ */
+static bool index_insert(Arena* a, Node* node) {
+    if (!index_reserve(a, 1)) return false;
+
+    size_t mask = a->indexCapacity - 1;
+    size_t i = index_hash(node->start) & mask;
+    while (a->blockIndex[i] != NULL) i = (i + 1) & mask;
+    index_write_begin(a);
+    __atomic_store_n(&a->blockIndex[i], node, __ATOMIC_RELAXED);
+    index_write_end(a);
+    a->indexCount++;
+    return true;
+}
+
+/**
+ * Removes a block record from the index. Later entries of the same probe run
+ * are shifted back into the hole so lookups never need tombstones.
+ *
+ * @param a The arena.
+ * @param node The record to remove. It must be in the index.
+ */
+static void index_remove(Arena* a, Node* node) {
+    size_t mask = a->indexCapacity - 1;
+    size_t hole = index_hash(node->start) & mask;
+    while (a->blockIndex[hole] != node) hole = (hole + 1) & mask;
+
+    index_write_begin(a);
+    for (size_t i = (hole + 1) & mask; a->blockIndex[i] != NULL;
+         i = (i + 1) & mask) {
+        size_t home = index_hash(a->blockIndex[i]->start) & mask;
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            __atomic_store_n(&a->blockIndex[hole], a->blockIndex[i],
+                             __ATOMIC_RELAXED);
+            hole = i;
+        }
+    }
+    __atomic_store_n(&a->blockIndex[hole], NULL, __ATOMIC_RELAXED);
+    index_write_end(a);
+    a->indexCount--;
+}
+
+/**
+ * Links a node into the address-sorted list right after another node.
+ *
+ * @param a The arena.
+ * @param node The node to link.
+ * @param prev The node to link after, or NULL to link at the head.
+ */
+static void link_after(Arena* a, Node* node, Node* prev) {
+    node->prev = prev;
+    node->next = prev ? prev->next : a->head;
+    if (node->next) {
+        node->next->prev = node;
+    } else {
+        a->tail = node;
+    }
+    if (prev) {
+        prev->next = node;
+    } else {
+        a->head = node;
+    }
+}
+
+/**
+ * Unlinks a node from the address-sorted list.
+ *
+ * @param a The arena.
+ * @param node The node to unlink.
+ */
+static void unlink_node(Arena* a, Node* node) {
+    if (a->rover == node) a->rover = node->prev;
+    if (node->prev) {
+        node->prev->next = node->next;
+    } else {
+        a->head = node->next;
+    }
+    if (node->next) {
+        node->next->prev = node->prev;
+    } else {
+        a->tail = node->prev;
+    }
+}
+
+/**
+ * Measures the gap between a list node and the node after it.
+ *
+ * @param a The arena.
+ * @param prev The node before the gap, or NULL for the gap before the head.
+ * @return The size of the gap.
+ */
+static size_t gap_after(Arena* a, Node* prev) {
+    void* start = prev ? prev->end : a->base;
+    Node* next = prev ? prev->next : a->head;
+    return (next ? next->start : a->base + a->engineLimit) - start;
+}
+
+/**
+ * Returns the height of a subtree of the gap tree.
+ */
+static int gap_height(Node* n) {
+    return n ? n->gapHeight : 0;
+}
+
+/**
+ * Recomputes the height of a gap tree node from its children.
+ */
+static void gap_update(Node* n) {
+    int left = gap_height(n->gapLeft);
+    int right = gap_height(n->gapRight);
+    n->gapHeight = (left > right ? left : right) + 1;
+}
+
+/**
+ * Rotates a gap subtree so its left child becomes its root.
+ */
+static Node* gap_rotate_right(Node* n) {
+    Node* l = n->gapLeft;
+    n->gapLeft = l->gapRight;
+    l->gapRight = n;
+    gap_update(n);
+    gap_update(l);
+    return l;
+}
+
+/**
+ * Rotates a gap subtree so its right child becomes its root.
+ */
+static Node* gap_rotate_left(Node* n) {
+    Node* r = n->gapRight;
+    n->gapRight = r->gapLeft;
+    r->gapLeft = n;
+    gap_update(n);
+    gap_update(r);
+    return r;
+}
+
+/**
+ * Restores the AVL balance of a gap subtree whose children differ in height
+ * by at most two.
+ *
+ * @param n The root of the subtree.
+ * @return The new root of the subtree.
+ */
+static Node* gap_balance(Node* n) {
+    gap_update(n);
+    int balance = gap_height(n->gapLeft) - gap_height(n->gapRight);
+    if (balance > 1) {
+        if (gap_height(n->gapLeft->gapLeft) <
+            gap_height(n->gapLeft->gapRight)) {
+            n->gapLeft = gap_rotate_left(n->gapLeft);
+        }
+        return gap_rotate_right(n);
+    }
+    if (balance < -1) {
+        if (gap_height(n->gapRight->gapRight) <
+            gap_height(n->gapRight->gapLeft)) {
+            n->gapRight = gap_rotate_right(n->gapRight);
+        }
+        return gap_rotate_left(n);
+    }
+    return n;
+}
+
+/**
+ * Orders gaps by size, then by address.
+ *
+ * @param x The node before one gap.
+ * @param y The node before the other gap.
+ * @return true if the gap after x comes before the gap after y.
+ */
+static bool gap_less(Node* x, Node* y) {
+    return x->gapSize < y->gapSize ||
+           (x->gapSize == y->gapSize && x->end < y->end);
+}
+
+/**
+ * Adds a node to a gap subtree.
+ *
+ * @param root The root of the subtree.
+ * @param node The node to add, with its gap size set.
+ * @return The new root of the subtree.
+ */
+static Node* gap_insert(Node* root, Node* node) {
+    if (root == NULL) return node;
+    if (gap_less(node, root)) {
+        root->gapLeft = gap_insert(root->gapLeft, node);
+    } else {
+        root->gapRight = gap_insert(root->gapRight, node);
+    }
+    return gap_balance(root);
+}
+
+/**
+ * Takes the first node out of a gap subtree.
+ *
+ * @param root The root of the subtree.
+ * @param first Set to the node taken out.
+ * @return The new root of the subtree.
+ */
+static Node* gap_remove_first(Node* root, Node** first) {
+    if (root->gapLeft == NULL) {
+        *first = root;
+        return root->gapRight;
+    }
+    root->gapLeft = gap_remove_first(root->gapLeft, first);
+    return gap_balance(root);
+}
+
+/**
+ * Takes a node out of a gap subtree.
+ *
+ * @param root The root of the subtree.
+ * @param node The node to take out. It must be in the subtree.
+ * @return The new root of the subtree.
+ */
+static Node* gap_remove(Node* root, Node* node) {
+    if (root != node) {
+        if (gap_less(node, root)) {
+            root->gapLeft = gap_remove(root->gapLeft, node);
+        } else {
+            root->gapRight = gap_remove(root->gapRight, node);
+        }
+        return gap_balance(root);
+    }
+    if (root->gapRight == NULL) return root->gapLeft;
+
+    Node* next;
+    Node* right = gap_remove_first(root->gapRight, &next);
+    next->gapLeft = root->gapLeft;
+    next->gapRight = right;
+    return gap_balance(next);
+}
+
+/**
+ * Finds the smallest gap of at least the given size, the lowest one among
+ * gaps of that size.
+ *
+ * @param root The root of the gap tree.
+ * @param size The minimum gap size.
+ * @return The node before the gap, or NULL if no gap is large enough.
+ */
+static Node* gap_lower_bound(Node* root, size_t size) {
+    Node* found = NULL;
+    while (root != NULL) {
+        if (root->gapSize >= size) {
+            found = root;
+            root = root->gapLeft;
+        } else {
+            root = root->gapRight;
+        }
+    }
+    return found;
+}
+
+/**
+ * Returns the height of a subtree of the gap address tree.
+ */
+static int addr_height(Node* n) {
+    return n ? n->addrHeight : 0;
+}
+
+/**
+ * Returns the largest gap in a subtree of the gap address tree.
+ */
+static size_t addr_max(Node* n) {
+    return n ? n->addrMax : 0;
+}
+
+/**
+ * Recomputes the height and largest gap of a gap address tree node from its
+ * children.
+ */
+static void addr_update(Node* n) {
+    int left = addr_height(n->addrLeft);
+    int right = addr_height(n->addrRight);
+    n->addrHeight = (left > right ? left : right) + 1;
+    n->addrMax = n->gapSize;
+    if (addr_max(n->addrLeft) > n->addrMax) n->addrMax = n->addrLeft->addrMax;
+    if (addr_max(n->addrRight) > n->addrMax) {
+        n->addrMax = n->addrRight->addrMax;
+    }
+}
+
+/**
+ * Rotates a gap address subtree so its left child becomes its root.
+ */
+static Node* addr_rotate_right(Node* n) {
+    Node* l = n->addrLeft;
+    n->addrLeft = l->addrRight;
+    l->addrRight = n;
+    addr_update(n);
+    addr_update(l);
+    return l;
+}
+
+/**
+ * Rotates a gap address subtree so its right child becomes its root.
+ */
+static Node* addr_rotate_left(Node* n) {
+    Node* r = n->addrRight;
+    n->addrRight = r->addrLeft;
+    r->addrLeft = n;
+    addr_update(n);
+    addr_update(r);
+    return r;
+}
+
+/**
+ * Restores the AVL balance of a gap address subtree whose children differ in
+ * height by at most two.
+ *
+ * @param n The root of the subtree.
+ * @return The new root of the subtree.
+ */
+static Node* addr_balance(Node* n) {
+    addr_update(n);
+    int balance = addr_height(n->addrLeft) - addr_height(n->addrRight);
+    if (balance > 1) {
+        if (addr_height(n->addrLeft->addrLeft) <
+            addr_height(n->addrLeft->addrRight)) {
+            n->addrLeft = addr_rotate_left(n->addrLeft);
+        }
+        return addr_rotate_right(n);
+    }
+    if (balance < -1) {
+        if (addr_height(n->addrRight->addrRight) <
+            addr_height(n->addrRight->addrLeft)) {
+            n->addrRight = addr_rotate_right(n->addrRight);
+        }
+        return addr_rotate_left(n);
+    }
+    return n;
+}
+
+/**
+ * Adds a node to a gap address subtree.
+ *
+ * @param root The root of the subtree.
+ * @param node The node to add, with its gap size set.
+ * @return The new root of the subtree.
+ */
+static Node* addr_insert(Node* root, Node* node) {
+    if (root == NULL) return node;
+    if (node->end < root->end) {
+        root->addrLeft = addr_insert(root->addrLeft, node);
+    } else {
+        root->addrRight = addr_insert(root->addrRight, node);
+    }
+    return addr_balance(root);
+}
+
+/**
+ * Takes the first node out of a gap address subtree.
+ *
+ * @param root The root of the subtree.
+ * @param first Set to the node taken out.
+ * @return The new root of the subtree.
+ */
+static Node* addr_remove_first(Node* root, Node** first) {
+    if (root->addrLeft == NULL) {
+        *first = root;
+        return root->addrRight;
+    }
+    root->addrLeft = addr_remove_first(root->addrLeft, first);
+    return addr_balance(root);
+}
+
+/**
+ * Takes a node out of a gap address subtree.
+ *
+ * @param root The root of the subtree.
+ * @param node The node to take out. It must be in the subtree.
+ * @return The new root of the subtree.
+ */
+static Node* addr_remove(Node* root, Node* node) {
+    if (root != node) {
+        if (node->end < root->end) {
+            root->addrLeft = addr_remove(root->addrLeft, node);
+        } else {
+            root->addrRight = addr_remove(root->addrRight, node);
+        }
+        return addr_balance(root);
+    }
+    if (root->addrRight == NULL) return root->addrLeft;
+
+    Node* next;
+    Node* right = addr_remove_first(root->addrRight, &next);
+    next->addrLeft = root->addrLeft;
+    next->addrRight = right;
+    return addr_balance(next);
+}
+
+/**
+ * Finds the lowest gap of at least the given size that starts at or after an
+ * address. Subtrees whose largest gap is too small are skipped, so this takes
+ * O(log n).
+ *
+ * @param root The root of the gap address tree.
+ * @param from The lowest start of a gap to consider.
+ * @param size The minimum gap size.
+ * @return The node before the gap, or NULL if no gap fits.
+ */
+static Node* addr_first_fit(Node* root, void* from, size_t size) {
+    if (root == NULL || root->addrMax < size) return NULL;
+    if (root->end >= from) {
+        Node* found = addr_first_fit(root->addrLeft, from, size);
+        if (found != NULL) return found;
+        if (root->gapSize >= size) return root;
+    }
+    return addr_first_fit(root->addrRight, from, size);
+}
+
+/**
+ * Adds the gap after a list node to the gap tree and the gap address tree.
+ * Empty gaps and the gap before the head are not tracked.
+ *
+ * @param a The arena.
+ * @param prev The node before the gap, or NULL.
+ */
+static void gap_track(Arena* a, Node* prev) {
+    if (prev == NULL) return;
+    prev->gapSize = gap_after(a, prev);
+    if (prev->gapSize == 0) return;
+    prev->gapLeft = NULL;
+    prev->gapRight = NULL;
+    prev->gapHeight = 1;
+    a->gapRoot = gap_insert(a->gapRoot, prev);
+    prev->addrLeft = NULL;
+    prev->addrRight = NULL;
+    prev->addrHeight = 1;
+    prev->addrMax = prev->gapSize;
+    a->addrRoot = addr_insert(a->addrRoot, prev);
+    a->gapBytes += prev->gapSize;
+}
+
+/**
+ * Removes the gap after a list node from the gap tree and the gap address
+ * tree. Must be called before the gap changes.
+ *
+ * @param a The arena.
+ * @param prev The node before the gap, or NULL.
+ */
+static void gap_untrack(Arena* a, Node* prev) {
+    if (prev == NULL || prev->gapSize == 0) return;
+    a->gapRoot = gap_remove(a->gapRoot, prev);
+    a->addrRoot = addr_remove(a->addrRoot, prev);
+    a->gapBytes -= prev->gapSize;
+    prev->gapSize = 0;
+}
+
+/**
+ * Links a node into the list engine's address-sorted list right after
+ * another node, keeping the gap tree up to date.
+ *
+ * @param a The arena.
+ * @param node The node to link.
+ * @param prev The node to link after, or NULL to link at the head.
+ */
+static void list_link(Arena* a, Node* node, Node* prev) {
+    gap_untrack(a, prev);
+    link_after(a, node, prev);
+    gap_track(a, prev);
+    gap_track(a, node);
+}
+
+/**
+ * Unlinks a node from the list engine's address-sorted list, merging the gaps
+ * on either side of it in the gap tree.
+ *
+ * @param a The arena.
+ * @param node The node to unlink.
+ */
+static void list_unlink(Arena* a, Node* node) {
+    Node* prev = node->prev;
+    gap_untrack(a, prev);
+    gap_untrack(a, node);
+    unlink_node(a, node);
+    gap_track(a, prev);
+}
+
+/**
+ * Moves the end of a list engine block, resizing the gap after it.
+ *
+ * @param a The arena.
+ * @param node The record of the block.
+ * @param end The new end of the block.
+ */
+static void list_set_end(Arena* a, Node* node, void* end) {
+    gap_untrack(a, node);
+    node_set_end(node, end);
+    gap_track(a, node);
+}
+
+/**
+ * Links a node back into the list engine's address-sorted list.
+ *
+ * @param a The arena.
+ * @param node The node to insert.
+ */
+static void insert_sorted(Arena* a, Node* node) {
+    Node* prev = NULL;
+    Node* walker = a->head;
+    while (walker != NULL && walker->start < node->start) {
+        prev = walker;
+        walker = walker->next;
+    }
+    list_link(a, node, prev);
+}
+
+/**
+ * Returns every block parked in the size-class free lists to the free space
+ * between list nodes so the gap walk can reuse and merge it.
+ *
+ * @param a The arena.
+ * @return true if at least one block was released.
+ */
+static bool flush_size_classes(Arena* a) {
+    bool released = false;
+    for (size_t size = 1; size <= SIZE_CLASS_MAX; size++) {
+        Node* node = a->sizeClasses[size];
+        while (node != NULL) {
+            Node* next = node->nextFree;
+            index_remove(a, node);
+            list_unlink(a, node);
+            node_release(a, node);
+            released = true;
+            node = next;
+        }
+        a->sizeClasses[size] = NULL;
+    }
+    return released;
+}
+
+/**
+ * Picks a gap for best or worst fit from the gap tree, or the gap before the
+ * head, which the tree does not track. Among gaps of the same size the lowest
+ * is picked.
+ *
+ * @param a The arena.
+ * @param size The size of the memory block to place.
+ * @param largest true for the largest gap, false for the smallest that fits.
+ * @param chosen Set to the node before the gap, or NULL for the gap before
+ * the head.
+ * @return true if a gap fits.
+ */
+static bool pick_from_tree(Arena* a, size_t size, bool largest,
+                           Node** chosen) {
+    Node* best;
+    if (largest) {
+        best = a->gapRoot;
+        while (best != NULL && best->gapRight != NULL) best = best->gapRight;
+        if (best != NULL) best = gap_lower_bound(a->gapRoot, best->gapSize);
+        if (best != NULL && best->gapSize < size) best = NULL;
+    } else {
+        best = gap_lower_bound(a->gapRoot, size);
+    }
+
+    size_t front = gap_after(a, NULL);
+    if (front >= size &&
+        (best == NULL ||
+         (largest ? front >= best->gapSize : front <= best->gapSize))) {
+        *chosen = NULL;
+        return true;
+    }
+    *chosen = best;
+    return best != NULL;
+}
+
+/**
+ * Places a new block of the given size in a gap between list nodes chosen by
+ * the placement policy. Best and worst fit look the gap up in the gap tree in
+ * O(log n). First and next fit take the lowest fitting gap from the gap
+ * address tree, also in O(log n): from the start of the arena, or for next fit
+ * from the last block placed, wrapping around to the start.
+ *
+ * @param a The arena.
+ * @param size The size of the memory block to allocate.
+ * @return A pointer to the allocated memory block, or NULL if no gap fits.
+ */
+static void* place_in_gap(Arena* a, size_t size) {
+    mem_policy_t p =
+        atomic_load_explicit(&a->pool->policy, memory_order_relaxed);
+    Node* chosen = NULL;
+    bool found = false;
+    if (p == MEM_POLICY_BEST_FIT || p == MEM_POLICY_WORST_FIT) {
+        found = pick_from_tree(a, size, p == MEM_POLICY_WORST_FIT, &chosen);
+    } else {
+        Node* rover = p == MEM_POLICY_NEXT_FIT ? a->rover : NULL;
+        if (rover != NULL) {
+            chosen = addr_first_fit(a->addrRoot, rover->end, size);
+        }
+        if (chosen == NULL && gap_after(a, NULL) < size) {
+            chosen = addr_first_fit(a->addrRoot, a->base, size);
+        }
+        found = chosen != NULL || gap_after(a, NULL) >= size;
+    }
+    if (!found) return NULL;
+
+    Node* nodeToAdd = node_alloc(a);
+    if (!nodeToAdd) return NULL;
+    node_set_start(nodeToAdd, chosen ? chosen->end : a->base);
+    node_set_end(nodeToAdd, nodeToAdd->start + size);
+    if (!index_insert(a, nodeToAdd)) {
+        node_release(a, nodeToAdd);
+        return NULL;
+    }
+    list_link(a, nodeToAdd, chosen);
+    a->rover = nodeToAdd;
+    return nodeToAdd->start;
+}
+
+/**
+ * Gives the whole pages inside a free range back to the kernel. The range
+ * stays mapped and reads as zeros once touched again. MADV_DONTNEED is used
+ * rather than MADV_FREE so the pages leave the resident set right away
+ * instead of under memory pressure.
+ *
+ * @param a The arena the range lies in.
+ * @param start The start of the free range.
+ * @param end The end of the free range.
+ * @return The number of bytes given back.
+ */
+static size_t purge_range(Arena* a, void* start, void* end) {
+    size_t page = a->pool->poolPageSize;
+    uintptr_t first = ((uintptr_t)start + page - 1) & ~(uintptr_t)(page - 1);
+    uintptr_t last = (uintptr_t)end & ~(uintptr_t)(page - 1);
+    if (last <= first) return 0;
+    if (madvise((void*)first, last - first, MADV_DONTNEED) != 0) return 0;
+    return last - first;
+}
+
+/**
+ * Allocates a block with the list engine. Small requests pop a parked block of
+ * the same size in O(1). Everything else, and small requests whose class is
+ * empty, are placed by the gap walk. When the walk fails the size classes are
+ * flushed back into the pool and the walk is retried, so parked blocks never
+ * cause an allocation to fail.
+ *
+ * @param a The arena.
+ * @param size The size of the memory block to allocate.
+ * @return A pointer to the allocated memory block, or NULL if the allocation
+ * fails.
+ */
+static void* list_alloc(Arena* a, size_t size) {
+    if (size <= SIZE_CLASS_MAX && a->sizeClasses[size] != NULL) {
+        Node* node = a->sizeClasses[size];
+        a->sizeClasses[size] = node->nextFree;
+        node->nextFree = NULL;
+        node_set_free(node, false);
+        return node->start;
+    }
+
+    void* block = place_in_gap(a, size);
+    if (block == NULL && flush_size_classes(a)) {
+        block = place_in_gap(a, size);
+    }
+    return block;
+}
+
+/**
+ * Frees a block with the list engine. Small blocks are parked in their size
+ * class instead of being unlinked, so the next request of the same size can
+ * reuse them without walking the list.
+ *
+ * @param a The arena.
+ * @param node The record of the block to free.
+ */
+static void list_free(Arena* a, Node* node) {
+    size_t size = node->end - node->start;
+    if (size <= SIZE_CLASS_MAX) {
+        node_set_free(node, true);
+        node->nextFree = a->sizeClasses[size];
+        a->sizeClasses[size] = node;
+    } else {
+        index_remove(a, node);
+        list_unlink(a, node);
+        node_release(a, node);
+    }
+}
+
+/**
+ * Takes a parked block out of its size class.
+ *
+ * @param a The arena.
+ * @param node The record of the parked block.
+ */
+static void unpark(Arena* a, Node* node) {
+    Node** link = &a->sizeClasses[node->end - node->start];
+    while (*link != node) link = &(*link)->nextFree;
+    *link = node->nextFree;
+    node->nextFree = NULL;
+}
+
+/**
+ * Resizes a block with the list engine. Shrinking gives the tail back to the
+ * gap after the block, and growing takes the gap if it is large enough, after
+ * dropping any parked blocks in the way. Only when the gap is too small is the
+ * block moved; it is unlinked first so the new placement may reuse its own
+ * range.
+ *
+ * @param a The arena.
+ * @param node The record of the block to resize.
+ * @param size The new size of the memory block.
+ * @return A pointer to the resized memory block, or NULL if the allocation
+ * fails.
+ */
+static void* list_resize(Arena* a, Node* node, size_t size) {
+    void* block = node->start;
+    size_t oldSize = node->end - node->start;
+
+    void* limit = node->next ? node->next->start : a->base + a->engineLimit;
+    while ((size_t)(limit - block) < size && node->next && node->next->free) {
+        Node* parked = node->next;
+        unpark(a, parked);
+        index_remove(a, parked);
+        list_unlink(a, parked);
+        node_release(a, parked);
+        limit = node->next ? node->next->start : a->base + a->engineLimit;
+    }
+    if ((size_t)(limit - block) >= size) {
+        list_set_end(a, node, block + size);
+        return block;
+    }
+
+    // Remove the old block from the list. It leaves the index too, since the
+    // new block may start at the same address.
+    index_remove(a, node);
+    list_unlink(a, node);
+
+    // Allocate a new block with the new size
+    void* newBlock = list_alloc(a, size);
+    if (newBlock) {
+        memmove(newBlock, block, (size < oldSize) ? size : oldSize);
+        node_release(a, node);
+        return newBlock;
+    }
+
+    // Allocation failed, restore the old block. The failed allocation may have
+    // flushed the size classes, so its old neighbours may be gone. Reinserting
+    // cannot grow the index, since it now holds fewer entries than before the
+    // old block was removed.
+    insert_sorted(a, node);
+    index_insert(a, node);
+    return NULL;
+}
+
+/**
+ * Prepares the list engine for an empty arena.
+ *
+ * @param a The arena.
+ */
+static bool list_engine_init(Arena* a) {
+    memset(a->sizeClasses, 0, sizeof(a->sizeClasses));
+    a->rover = NULL;
+    a->gapRoot = NULL;
+    a->addrRoot = NULL;
+    a->gapBytes = 0;
+    return true;
+}
+
+/**
+ * Hands a range of the arena to the list engine. Free ranges need no record,
+ * since the gaps between list nodes are free; the gap at the top of the arena
+ * is measured again, as a free range may have moved the engine's limit.
+ *
+ * @param a The arena.
+ * @param start The start of the range.
+ * @param end The end of the range.
+ * @param used true if the range is an allocated block.
+ * @return true on success, false if no record could be added for a used
+ * range, in which case the engine is left unchanged.
+ */
+static bool list_adopt(Arena* a, void* start, void* end, bool used) {
+    if (!used) {
+        gap_untrack(a, a->tail);
+        gap_track(a, a->tail);
+        return true;
+    }
+
+    Node* node = node_alloc(a);
+    if (!node) return false;
+    node_set_start(node, start);
+    node_set_end(node, end);
+    if (!index_insert(a, node)) {
+        node_release(a, node);
+        return false;
+    }
+    list_link(a, node, NULL);
+    return true;
+}
+
+/**
+ * Splits a used block in two with the list engine.
+ *
+ * @param a The arena.
+ * @param node The record of the used block.
+ * @param size The size to keep. The rest becomes a used block of its own.
+ * @return true on success, false if no record could be added.
+ */
+static bool list_split(Arena* a, Node* node, size_t size) {
+    Node* rest = node_alloc(a);
+    if (!rest) return false;
+    node_set_start(rest, node->start + size);
+    node_set_end(rest, node->end);
+    if (!index_insert(a, rest)) {
+        node_release(a, rest);
+        return false;
+    }
+    list_set_end(a, node, rest->start);
+    list_link(a, rest, node);
+    return true;
+}
+
+/**
+ * Orders handles by the address of their blocks for qsort.
+ */
+static int compare_handle(const void* x, const void* y) {
+    void* p = (*(mem_handle_t* const*)x)->block;
+    void* q = (*(mem_handle_t* const*)y)->block;
+    return (p > q) - (p < q);
+}
+
+/**
+ * Slides every unlocked handle block of a list engine arena down against the
+ * block before it, so the free space between them gathers above the last
+ * block that cannot move. Blocks without a handle and locked handle blocks
+ * stay where they are. Parked blocks must have been flushed.
+ *
+ * @param a The arena.
+ * @param handles The handles in use, sorted by block address.
+ * @param count The number of handles.
+ * @return The number of bytes moved.
+ */
+static size_t list_compact(Arena* a, mem_handle_t** handles, size_t count) {
+    size_t moved = 0;
+    size_t h = 0;
+    void* dest = a->base;
+    for (Node* node = a->head; node != NULL; node = node->next) {
+        while (h < count && handles[h]->block < node->start) h++;
+        int unlocked = 0;
+        if (node->start > dest && h < count &&
+            handles[h]->block == node->start &&
+            atomic_compare_exchange_strong_explicit(
+                &handles[h]->locks, &unlocked, HANDLE_MOVING,
+                memory_order_acquire, memory_order_relaxed)) {
+            size_t size = node->end - node->start;
+            memmove(dest, node->start, size);
+
+            // The index holds one entry fewer while the block is moved, so
+            // reinserting it cannot fail
+            Node* prev = node->prev;
+            gap_untrack(a, prev);
+            gap_untrack(a, node);
+            index_remove(a, node);
+            node_set_start(node, dest);
+            node_set_end(node, dest + size);
+            index_insert(a, node);
+            gap_track(a, prev);
+            gap_track(a, node);
+
+            handles[h]->block = dest;
+            atomic_store_explicit(&handles[h]->locks, 0, memory_order_release);
+            moved += size;
+        }
+        dest = node->end;
+    }
+    return moved;
+}
+
+/**
+ * Gives the free pages of an arena back to the kernel with the list engine.
+ * Parked blocks are flushed first so they merge into the gaps around them.
+ *
+ * @param a The arena.
+ * @return The number of bytes given back.
+ */
+static size_t list_purge(Arena* a) {
+    flush_size_classes(a);
+    size_t released = 0;
+    Node* prev = NULL;
+    do {
+        void* start = prev ? prev->end : a->base;
+        released += purge_range(a, start, start + gap_after(a, prev));
+        prev = prev ? prev->next : a->head;
+    } while (prev != NULL);
+    return released;
+}
+
+/**
+ * Drops the list engine's size classes. Their records are freed with the
+ * record chunks.
+ *
+ * @param a The arena.
+ */
+static void list_engine_deinit(Arena* a) {
+    memset(a->sizeClasses, 0, sizeof(a->sizeClasses));
+    a->rover = NULL;
+    a->gapRoot = NULL;
+    a->addrRoot = NULL;
+    a->gapBytes = 0;
+}
+
+/**
+ * Maps a block size to its TLSF list. Sizes below TLSF_SL_COUNT get a list of
+ * their own; larger sizes are split into TLSF_SL_COUNT linear steps per power
+ * of two.
+ *
+ * @param size The block size.
+ * @param fl Receives the first-level index.
+ * @param sl Receives the second-level index.
+ */
+static void tlsf_mapping(size_t size, int* fl, int* sl) {
+    if (size < TLSF_SL_COUNT) {
+        *fl = 0;
+        *sl = (int)size;
+        return;
+    }
+    int log2 = 63 - __builtin_clzll(size);
+    *fl = log2 - TLSF_SL_LOG2 + 1;
+    *sl = (int)(size >> (log2 - TLSF_SL_LOG2)) ^ TLSF_SL_COUNT;
+}
+
+/**
+ * Maps a request size to the first TLSF list whose blocks are all large
+ * enough to hold it, by rounding the size up to the next list boundary.
+ *
+ * @param size The request size.
+ * @param fl Receives the first-level index.
+ * @param sl Receives the second-level index.
+ */
+static void tlsf_mapping_search(size_t size, int* fl, int* sl) {
+    if (size >= TLSF_SL_COUNT) {
+        int log2 = 63 - __builtin_clzll(size);
+        size += ((size_t)1 << (log2 - TLSF_SL_LOG2)) - 1;
+    }
+    tlsf_mapping(size, fl, sl);
+}
+
+/**
+ * Adds a free block to its TLSF list.
+ *
+ * @param a The arena.
+ * @param node The record of the free block.
+ */
+static void tlsf_insert(Arena* a, Node* node) {
+    int fl, sl;
+    tlsf_mapping(node->end - node->start, &fl, &sl);
+
+    node_set_free(node, true);
+    node->prevFree = NULL;
+    node->nextFree = a->tlsfBlocks[fl][sl];
+    if (node->nextFree) node->nextFree->prevFree = node;
+    a->tlsfBlocks[fl][sl] = node;
+    a->tlsfFlBitmap |= 1ULL << fl;
+    a->tlsfSlBitmap[fl] |= 1U << sl;
+}
+
+/**
+ * Removes a free block from its TLSF list.
+ *
+ * @param a The arena.
+ * @param node The record of the free block.
+ */
+static void tlsf_remove(Arena* a, Node* node) {
+    int fl, sl;
+    tlsf_mapping(node->end - node->start, &fl, &sl);
+
+    if (node->prevFree) {
+        node->prevFree->nextFree = node->nextFree;
+    } else {
+        a->tlsfBlocks[fl][sl] = node->nextFree;
+        if (a->tlsfBlocks[fl][sl] == NULL) {
+            a->tlsfSlBitmap[fl] &= ~(1U << sl);
+            if (a->tlsfSlBitmap[fl] == 0) a->tlsfFlBitmap &= ~(1ULL << fl);
+        }
+    }
+    if (node->nextFree) node->nextFree->prevFree = node->prevFree;
+
+    node_set_free(node, false);
+    node->nextFree = NULL;
+    node->prevFree = NULL;
+}
+
+/**
+ * Finds a non-empty TLSF list at or above the given one using the bitmaps.
+ *
+ * @param a The arena.
+ * @param fl The first-level index to start from.
+ * @param sl The second-level index to start from.
+ * @return The first free block of that list, or NULL if every list above is
+ * empty.
+ */
+static Node* tlsf_find(Arena* a, int fl, int sl) {
+    if (fl >= TLSF_FL_COUNT) return NULL;
+
+    uint32_t slMap = a->tlsfSlBitmap[fl] & (~0U << sl);
+    if (slMap == 0) {
+        uint64_t flMap =
+            fl + 1 < TLSF_FL_COUNT ? a->tlsfFlBitmap & (~0ULL << (fl + 1)) : 0;
+        if (flMap == 0) return NULL;
+        fl = __builtin_ctzll(flMap);
+        slMap = a->tlsfSlBitmap[fl];
+    }
+    return a->tlsfBlocks[fl][__builtin_ctz(slMap)];
+}
+
+/**
+ * Returns a block to the free lists, merging it with free physical
+ * neighbours first.
+ *
+ * @param a The arena.
+ * @param node The record of the block. It must not be in the index.
+ */
+static void tlsf_release(Arena* a, Node* node) {
+    Node* prev = node->prev;
+    if (prev && prev->free) {
+        tlsf_remove(a, prev);
+        node_set_end(prev, node->end);
+        unlink_node(a, node);
+        node_release(a, node);
+        node = prev;
+    }
+
+    Node* next = node->next;
+    if (next && next->free) {
+        tlsf_remove(a, next);
+        node_set_end(node, next->end);
+        unlink_node(a, next);
+        node_release(a, next);
+    }
+
+    tlsf_insert(a, node);
+}
+
+/**
+ * Trims a used block down to the given size and returns the tail to the free
+ * lists. The block is kept whole if no record is available for the tail.
+ *
+ * @param a The arena.
+ * @param node The record of the used block.
+ * @param size The size to keep.
+ */
+static void tlsf_trim(Arena* a, Node* node, size_t size) {
+    if ((size_t)(node->end - node->start) == size) return;
+
+    Node* rest = node_alloc(a);
+    if (!rest) return;
+    node_set_start(rest, node->start + size);
+    node_set_end(rest, node->end);
+    node_set_end(node, rest->start);
+    link_after(a, rest, node);
+    tlsf_release(a, rest);
+}
+
+/**
+ * Allocates a block with the TLSF engine in O(1). The request is rounded up to
+ * a list whose blocks all fit, so the bitmaps pick a block without looking at
+ * any list. If that fails the first TLSF_FIT_PROBES blocks of the request's
+ * own list are checked, since rounding skips blocks that would fit exactly.
+ * A block that fits deeper in that list is not found, so a fragmented pool
+ * may fail a request it could hold; in exchange the worst case stays O(1).
+ *
+ * @param a The arena.
+ * @param size The size of the memory block to allocate.
+ * @return A pointer to the allocated memory block, or NULL if the allocation
+ * fails.
+ */
+static void* tlsf_alloc(Arena* a, size_t size) {
+    int fl, sl;
+    tlsf_mapping_search(size, &fl, &sl);
+    Node* block = tlsf_find(a, fl, sl);
+
+    if (block == NULL) {
+        tlsf_mapping(size, &fl, &sl);
+        block = a->tlsfBlocks[fl][sl];
+        for (int probes = 1;
+             block != NULL && (size_t)(block->end - block->start) < size;
+             probes++) {
+            block = probes < TLSF_FIT_PROBES ? block->nextFree : NULL;
+        }
+        if (block == NULL) return NULL;
+    }
+
+    tlsf_remove(a, block);
+    if (!index_insert(a, block)) {
+        tlsf_insert(a, block);
+        return NULL;
+    }
+    tlsf_trim(a, block, size);
+    return block->start;
+}
+
+/**
+ * Frees a block with the TLSF engine in O(1).
+ *
+ * @param a The arena.
+ * @param node The record of the block to free.
+ */
+static void tlsf_free(Arena* a, Node* node) {
+    index_remove(a, node);
+    tlsf_release(a, node);
+}
+
+/**
+ * Resizes a block with the TLSF engine. Shrinking and growing into a free
+ * physical successor happen in place; otherwise the block is moved.
+ *
+ * @param a The arena.
+ * @param node The record of the block to resize.
+ * @param size The new size of the memory block.
+ * @return A pointer to the resized memory block, or NULL if the allocation
+ * fails.
+ */
+static void* tlsf_resize(Arena* a, Node* node, size_t size) {
+    size_t oldSize = node->end - node->start;
+    Node* next = node->next;
+
+    if (size > oldSize && next && next->free &&
+        (size_t)(next->end - node->start) >= size) {
+        tlsf_remove(a, next);
+        node_set_end(node, next->end);
+        unlink_node(a, next);
+        node_release(a, next);
+    }
+
+    if ((size_t)(node->end - node->start) >= size) {
+        tlsf_trim(a, node, size);
+        return node->start;
+    }
+
+    void* newBlock = tlsf_alloc(a, size);
+    if (!newBlock) return NULL;
+    memcpy(newBlock, node->start, oldSize);
+    tlsf_free(a, node);
+    return newBlock;
+}
+
+/**
+ * Prepares the TLSF engine's free lists for an arena.
+ *
+ * @param a The arena.
+ */
+static bool tlsf_engine_init(Arena* a) {
+    a->tlsfFlBitmap = 0;
+    memset(a->tlsfSlBitmap, 0, sizeof(a->tlsfSlBitmap));
+    memset(a->tlsfBlocks, 0, sizeof(a->tlsfBlocks));
+    return true;
+}
+
+/**
+ * Hands a range of the arena to the TLSF engine. A range below every block is
+ * linked at the head. A range above every block is linked at the tail, and
+ * a free one is merged into a free block that ends where it starts.
+ *
+ * @param a The arena.
+ * @param start The start of the range.
+ * @param end The end of the range.
+ * @param used true if the range is an allocated block.
+ * @return true on success, false if no record could be added, in which case
+ * the engine is left unchanged.
+ */
+static bool tlsf_adopt(Arena* a, void* start, void* end, bool used) {
+    Node* prev = a->tail && a->tail->end <= start ? a->tail : NULL;
+    if (!used && prev && prev->free && prev->end == start) {
+        tlsf_remove(a, prev);
+        node_set_end(prev, end);
+        tlsf_insert(a, prev);
+        return true;
+    }
+
+    Node* node = node_alloc(a);
+    if (!node) return false;
+    node_set_start(node, start);
+    node_set_end(node, end);
+    if (used && !index_insert(a, node)) {
+        node_release(a, node);
+        return false;
+    }
+    link_after(a, node, prev);
+    if (!used) tlsf_insert(a, node);
+    return true;
+}
+
+/**
+ * Splits a used block in two with the TLSF engine.
+ *
+ * @param a The arena.
+ * @param node The record of the used block.
+ * @param size The size to keep. The rest becomes a used block of its own.
+ * @return true on success, false if no record could be added.
+ */
+static bool tlsf_split(Arena* a, Node* node, size_t size) {
+    Node* rest = node_alloc(a);
+    if (!rest) return false;
+    node_set_start(rest, node->start + size);
+    node_set_end(rest, node->end);
+    if (!index_insert(a, rest)) {
+        node_release(a, rest);
+        return false;
+    }
+    node_set_end(node, rest->start);
+    link_after(a, rest, node);
+    return true;
+}
+
+/**
+ * Gives the free pages of an arena back to the kernel with the TLSF engine.
+ *
+ * @param a The arena.
+ * @return The number of bytes given back.
+ */
+static size_t tlsf_purge(Arena* a) {
+    size_t released = 0;
+    for (int fl = 0; fl < TLSF_FL_COUNT; fl++) {
+        if (!(a->tlsfFlBitmap & (1ULL << fl))) continue;
+        for (int sl = 0; sl < TLSF_SL_COUNT; sl++) {
+            for (Node* node = a->tlsfBlocks[fl][sl]; node != NULL;
+                 node = node->nextFree) {
+                released += purge_range(a, node->start, node->end);
+            }
+        }
+    }
+    return released;
+}
+
+/**
+ * Drops the TLSF engine's free lists. Their records are freed with the record
+ * chunks.
+ *
+ * @param a The arena.
+ */
+static void tlsf_engine_deinit(Arena* a) {
+    a->tlsfFlBitmap = 0;
+}
+
+/**
+ * Tests whether the buddy block of the given order at the given offset is on
+ * a free list.
+ *
+ * @param a The arena.
+ * @param off The offset of the block from the start of the arena.
+ * @param order The order of the block.
+ * @return true if the block lies inside the arena and is free.
+ */
+static bool buddy_is_free(Arena* a, size_t off, int order) {
+    if (order > a->buddyMaxOrder ||
+        off + ((size_t)1 << order) > a->buddyLimit) {
+        return false;
+    }
+    size_t i = off >> order;
+    return (a->buddyBitmaps[order][i / 64] >> (i % 64)) & 1;
+}
+
+/**
+ * Puts a buddy block on the free list of its order. The list links are stored
+ * in the free block itself.
+ *
+ * @param a The arena.
+ * @param off The offset of the block from the start of the arena.
+ * @param order The order of the block.
+ */
+static void buddy_push(Arena* a, size_t off, int order) {
+    BuddyBlock* block = a->base + off;
+    block->prev = NULL;
+    block->next = a->buddyFree[order];
+    if (block->next) block->next->prev = block;
+    a->buddyFree[order] = block;
+    a->buddyOrderMask |= 1ULL << order;
+
+    size_t i = off >> order;
+    a->buddyBitmaps[order][i / 64] |= 1ULL << (i % 64);
+}
+
+/**
+ * Takes a buddy block off the free list of its order.
+ *
+ * @param a The arena.
+ * @param off The offset of the block from the start of the arena.
+ * @param order The order of the block.
+ */
+static void buddy_unlink(Arena* a, size_t off, int order) {
+    BuddyBlock* block = a->base + off;
+    if (block->prev) {
+        block->prev->next = block->next;
+    } else {
+        a->buddyFree[order] = block->next;
+        if (a->buddyFree[order] == NULL) a->buddyOrderMask &= ~(1ULL << order);
+    }
+    if (block->next) block->next->prev = block->prev;
+
+    size_t i = off >> order;
+    a->buddyBitmaps[order][i / 64] &= ~(1ULL << (i % 64));
+}
+
+/**
+ * Frees a buddy block, merging it with its buddy for as long as the buddy is
+ * free. The buddy of a block is found by flipping the bit of its order in its
+ * offset.
+ *
+ * @param a The arena.
+ * @param off The offset of the block from the start of the arena.
+ * @param order The order of the block.
+ */
+static void buddy_release(Arena* a, size_t off, int order) {
+    while (order < a->buddyMaxOrder) {
+        size_t buddy = off ^ ((size_t)1 << order);
+        if (!buddy_is_free(a, buddy, order)) break;
+        buddy_unlink(a, buddy, order);
+        off &= ~((size_t)1 << order);
+        order++;
+    }
+    buddy_push(a, off, order);
+}
+
+/**
+ * Frees the range [off, end) by splitting it into the largest aligned buddy
+ * blocks that fit.
+ *
+ * @param a The arena.
+ * @param off The offset of the range. A multiple of the minimum block size.
+ * @param end The end offset of the range. A multiple of the minimum block size.
+ */
+static void buddy_release_range(Arena* a, size_t off, size_t end) {
+    while (off < end) {
+        int order = 63 - __builtin_clzll(end - off);
+        if (off != 0 && __builtin_ctzll(off) < order) {
+            order = __builtin_ctzll(off);
+        }
+        buddy_release(a, off, order);
+        off += (size_t)1 << order;
+    }
+}
+
+/**
+ * Finds the free buddy block containing the given offset.
+ *
+ * @param a The arena.
+ * @param p The offset to look up.
+ * @param start Receives the offset of the free block.
+ * @param order Receives the order of the free block.
+ * @return true if p lies inside a free block.
+ */
+static bool buddy_find_free(Arena* a, size_t p, size_t* start, int* order) {
+    for (int k = BUDDY_MIN_ORDER; k <= a->buddyMaxOrder; k++) {
+        size_t off = p & ~(((size_t)1 << k) - 1);
+        if (buddy_is_free(a, off, k)) {
+            *start = off;
+            *order = k;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Tests whether every byte of the range [off, end) is free.
+ *
+ * @param a The arena.
+ * @param off The offset of the range.
+ * @param end The end offset of the range.
+ * @return true if the range is free.
+ */
+static bool buddy_range_is_free(Arena* a, size_t off, size_t end) {
+    if (end > a->buddyLimit) return false;
+
+    while (off < end) {
+        size_t start;
+        int order;
+        if (!buddy_find_free(a, off, &start, &order)) return false;
+        off = start + ((size_t)1 << order);
+    }
+    return true;
+}
+
+/**
+ * Takes the free range [off, end) off the free lists. Every free block that
+ * overlaps the range is split, and the parts outside the range are freed
+ * again.
+ *
+ * @param a The arena.
+ * @param off The offset of the range.
+ * @param end The end offset of the range. The range must be free.
+ */
+static void buddy_carve(Arena* a, size_t off, size_t end) {
+    size_t p = off;
+    while (p < end) {
+        size_t start;
+        int order;
+        buddy_find_free(a, p, &start, &order);
+        buddy_unlink(a, start, order);
+
+        size_t blockEnd = start + ((size_t)1 << order);
+        if (start < off) buddy_release_range(a, start, off);
+        if (blockEnd > end) buddy_release_range(a, end, blockEnd);
+        p = blockEnd;
+    }
+}
+
+/**
+ * Looks for any run of free blocks at least the given size long, for requests
+ * that no single free block can hold.
+ *
+ * @param a The arena.
+ * @param size The size of the run. A multiple of the minimum block size.
+ * @param off Receives the offset of the run.
+ * @return true if a run was found.
+ */
+static bool buddy_find_run(Arena* a, size_t size, size_t* off) {
+    for (int k = BUDDY_MIN_ORDER; k <= a->buddyMaxOrder; k++) {
+        for (BuddyBlock* block = a->buddyFree[k]; block; block = block->next) {
+            size_t start = (void*)block - a->base;
+            if (buddy_range_is_free(a, start, start + size)) {
+                *off = start;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/**
+ * Allocates a block with the buddy engine. The request is rounded up to the
+ * minimum block size and taken from the smallest free block of a large enough
+ * order, found with one bit scan. The block is split down in O(log n), and the
+ * part the request does not need is freed again as smaller blocks, so a 192
+ * byte request occupies 192 bytes rather than 256.
+ *
+ * If no single block is large enough, the free lists are searched for a run of
+ * neighbouring free blocks instead. That keeps a pool usable to the last byte,
+ * at the cost of a walk over the free lists on that path only.
+ *
+ * @param a The arena.
+ * @param size The size of the memory block to allocate.
+ * @return A pointer to the allocated memory block, or NULL if the allocation
+ * fails.
+ */
+static void* buddy_alloc(Arena* a, size_t size) {
+    size_t need = (size + BUDDY_MIN_SIZE - 1) & ~(size_t)(BUDDY_MIN_SIZE - 1);
+    if (need > a->buddyLimit) return NULL;
+
+    int order = 64 - __builtin_clzll(need - 1);
+    if (order < BUDDY_MIN_ORDER) order = BUDDY_MIN_ORDER;
+
+    size_t off;
+    uint64_t orders = a->buddyOrderMask & (~0ULL << order);
+    if (order <= a->buddyMaxOrder && orders != 0) {
+        off = (void*)a->buddyFree[__builtin_ctzll(orders)] - a->base;
+    } else if (!buddy_find_run(a, need, &off)) {
+        return NULL;
+    }
+
+    Node* node = node_alloc(a);
+    if (!node) return NULL;
+    node_set_start(node, a->base + off);
+    node_set_end(node, node->start + need);
+    if (!index_insert(a, node)) {
+        node_release(a, node);
+        return NULL;
+    }
+    buddy_carve(a, off, off + need);
+    return node->start;
+}
+
+/**
+ * Frees a block with the buddy engine.
+ *
+ * @param a The arena.
+ * @param node The record of the block to free.
+ */
+static void buddy_free(Arena* a, Node* node) {
+    index_remove(a, node);
+    buddy_release_range(a, node->start - a->base, node->end - a->base);
+    node_release(a, node);
+}
+
+/**
+ * Resizes a block with the buddy engine. Shrinking, and growing into free
+ * space right after the block, happen in place; otherwise the block is moved.
+ *
+ * @param a The arena.
+ * @param node The record of the block to resize.
+ * @param size The new size of the memory block.
+ * @return A pointer to the resized memory block, or NULL if the allocation
+ * fails.
+ */
+static void* buddy_resize(Arena* a, Node* node, size_t size) {
+    size_t need = (size + BUDDY_MIN_SIZE - 1) & ~(size_t)(BUDDY_MIN_SIZE - 1);
+    size_t off = node->start - a->base;
+    size_t end = node->end - a->base;
+
+    if (off + need <= end) {
+        buddy_release_range(a, off + need, end);
+        node_set_end(node, node->start + need);
+        return node->start;
+    }
+
+    if (buddy_range_is_free(a, end, off + need)) {
+        buddy_carve(a, end, off + need);
+        node_set_end(node, node->start + need);
+        return node->start;
+    }
+
+    void* newBlock = buddy_alloc(a, size);
+    if (!newBlock) return NULL;
+    memcpy(newBlock, node->start, end - off);
+    buddy_free(a, node);
+    return newBlock;
+}
+
+/**
+ * Maps zeroed memory for arena metadata that grows with the arena's size. The
+ * mapping is not charged against the commit limit and its pages are only
+ * backed once touched, so the metadata of capacity an arena never reaches
+ * costs no memory.
+ *
+ * @param bytes The size of the mapping.
+ * @return A pointer to the mapping, or NULL if it could not be made.
+ */
+static void* metadata_map(size_t bytes) {
+    void* map = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return map == MAP_FAILED ? NULL : map;
+}
+
+/**
+ * Prepares the buddy engine's free lists and bitmaps for an arena. Bytes past
+ * the last multiple of the minimum block size are not used. The bitmaps cover
+ * the whole arena but are mapped lazily, so only the words for the part
+ * handed to the engine are ever backed.
+ *
+ * @param a The arena, with the bitmaps of an earlier setup over the same range
+ * still attached if they are to be cleared and reused.
+ * @return true on success, false if the bitmaps could not be mapped.
+ */
+static bool buddy_engine_init(Arena* a) {
+    memset(a->buddyFree, 0, sizeof(a->buddyFree));
+    memset(a->buddyBitmaps, 0, sizeof(a->buddyBitmaps));
+    a->buddyOrderMask = 0;
+    a->buddyLimit = a->size & ~(size_t)(BUDDY_MIN_SIZE - 1);
+    a->buddyMaxOrder = a->buddyLimit ? 63 - __builtin_clzll(a->buddyLimit) : 0;
+    if (a->buddyLimit == 0) return true;
+
+    size_t words = 0;
+    for (int k = BUDDY_MIN_ORDER; k <= a->buddyMaxOrder; k++) {
+        words += ((a->buddyLimit >> k) + 63) / 64;
+    }
+    if (a->buddyBitmapStore) {
+        madvise(a->buddyBitmapStore, a->buddyBitmapSize, MADV_DONTNEED);
+    } else {
+        a->buddyBitmapStore = metadata_map(words * sizeof(uint64_t));
+    }
+    if (!a->buddyBitmapStore) {
+        a->buddyLimit = 0;
+        return false;
+    }
+    a->buddyBitmapSize = words * sizeof(uint64_t);
+    for (size_t k = BUDDY_MIN_ORDER, w = 0; k <= (size_t)a->buddyMaxOrder;
+         k++) {
+        a->buddyBitmaps[k] = a->buddyBitmapStore + w;
+        w += ((a->buddyLimit >> k) + 63) / 64;
+    }
+    return true;
+}
+
+/**
+ * Hands a range of the arena to the buddy engine.
+ *
+ * @param a The arena.
+ * @param start The start of the range. A multiple of the minimum block size.
+ * @param end The end of the range. A multiple of the minimum block size.
+ * @param used true if the range is an allocated block.
+ * @return true on success, false if no record could be added for a used
+ * range, in which case the engine is left unchanged.
+ */
+static bool buddy_adopt(Arena* a, void* start, void* end, bool used) {
+    if (!used) {
+        if (a->buddyLimit) {
+            buddy_release_range(a, start - a->base, end - a->base);
+        }
+        return true;
+    }
+
+    Node* node = node_alloc(a);
+    if (!node) return false;
+    node_set_start(node, start);
+    node_set_end(node, end);
+    if (!index_insert(a, node)) {
+        node_release(a, node);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Splits a used block in two with the buddy engine.
+ *
+ * @param a The arena.
+ * @param node The record of the used block.
+ * @param size The size to keep, a multiple of the minimum block size. The rest
+ * becomes a used block of its own.
+ * @return true on success, false if no record could be added.
+ */
+static bool buddy_split(Arena* a, Node* node, size_t size) {
+    Node* rest = node_alloc(a);
+    if (!rest) return false;
+    node_set_start(rest, node->start + size);
+    node_set_end(rest, node->end);
+    if (!index_insert(a, rest)) {
+        node_release(a, rest);
+        return false;
+    }
+    node_set_end(node, rest->start);
+    return true;
+}
+
+/**
+ * Gives the free pages of an arena back to the kernel with the buddy engine.
+ * The free-list links at the start of every free block are kept.
+ *
+ * @param a The arena.
+ * @return The number of bytes given back.
+ */
+static size_t buddy_purge(Arena* a) {
+    size_t released = 0;
+    for (int k = BUDDY_MIN_ORDER; k <= a->buddyMaxOrder; k++) {
+        for (BuddyBlock* block = a->buddyFree[k]; block != NULL;
+             block = block->next) {
+            released += purge_range(a, block + 1, (void*)block + (1UL << k));
+        }
+    }
+    return released;
+}
+
+/**
+ * Releases the buddy engine's free bitmaps.
+ *
+ * @param a The arena.
+ */
+static void buddy_engine_deinit(Arena* a) {
+    if (a->buddyBitmapStore) munmap(a->buddyBitmapStore, a->buddyBitmapSize);
+    a->buddyBitmapStore = NULL;
+    a->buddyLimit = 0;
+}
+
+static const Engine listEngine = {1,          list_engine_init,
+                                  list_engine_deinit, list_alloc,
+                                  list_free,  list_resize,
+                                  list_adopt, list_split,
+                                  list_purge};
+static const Engine tlsfEngine = {1,          tlsf_engine_init,
+                                  tlsf_engine_deinit, tlsf_alloc,
+                                  tlsf_free,  tlsf_resize,
+                                  tlsf_adopt, tlsf_split,
+                                  tlsf_purge};
+static const Engine buddyEngine = {BUDDY_MIN_SIZE,      buddy_engine_init,
+                                   buddy_engine_deinit, buddy_alloc,
+                                   buddy_free,          buddy_resize,
+                                   buddy_adopt,         buddy_split,
+                                   buddy_purge};
+
+/**
+ * Makes the start of an arena accessible up to at least the given address,
+ * rounded up to a whole commit chunk. Concurrent callers may commit the same
+ * pages; the committed size only grows.
+ *
+ * @param a The arena.
+ * @param end The end of the range that must be accessible.
+ * @return true on success, false if the pages could not be committed.
+ */
+static bool arena_commit(Arena* a, void* end) {
+    size_t need = end - a->base;
+    size_t done = atomic_load_explicit(&a->committed, memory_order_acquire);
+    if (need <= done) return true;
+
+    size_t target = (need + COMMIT_CHUNK - 1) & ~(COMMIT_CHUNK - 1);
+    if (target > a->size) target = a->size;
+    uintptr_t first = (uintptr_t)(a->base + done) &
+                      ~(uintptr_t)(pageSize - 1);
+    uintptr_t last = ((uintptr_t)(a->base + target) + pageSize - 1) &
+                     ~(uintptr_t)(pageSize - 1);
+    if (mprotect((void*)first, last - first, PROT_READ | PROT_WRITE) != 0) {
+        return false;
+    }
+    while (done < target &&
+           !atomic_compare_exchange_weak_explicit(&a->committed, &done, target,
+                                                  memory_order_release,
+                                                  memory_order_acquire)) {
+    }
+    return true;
+}
+
+/**
+ * Sets or clears the end mark of a granule of the tail.
+ *
+ * @param a The arena.
+ * @param g The index of the granule.
+ * @param set true to set the mark, false to clear it.
+ */
+static void bump_mark(Arena* a, size_t g, bool set) {
+    if (set) {
+        __atomic_fetch_or(&a->bumpEnds[g / 64], 1ULL << (g % 64),
+                          __ATOMIC_RELAXED);
+    } else {
+        __atomic_fetch_and(&a->bumpEnds[g / 64], ~(1ULL << (g % 64)),
+                           __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * Bumps a block off the untouched tail of an arena without taking its lock.
+ *
+ * @param a The arena.
+ * @param size The size of the block, a multiple of the bump unit.
+ * @return A pointer to the block, or NULL if the tail is too short or has
+ * been absorbed.
+ */
+static void* bump_alloc(Arena* a, size_t size) {
+    size_t top = atomic_load_explicit(&a->bumpTop, memory_order_relaxed);
+    do {
+        if (size > a->bumpLimit - top) return NULL;
+        if (!arena_commit(a, a->base + top + size)) return NULL;
+    } while (!atomic_compare_exchange_weak_explicit(
+        &a->bumpTop, &top, top + size, memory_order_relaxed,
+        memory_order_relaxed));
+
+    bump_mark(a, (top + size - 1) >> a->bumpShift, true);
+    atomic_fetch_add_explicit(&a->bumpCommitted, size, memory_order_release);
+    return a->base + top;
+}
+
+/**
+ * Finds the size of a bumped block from the end mark after its start.
+ *
+ * @param a The arena.
+ * @param block A block bumped off the tail of the arena.
+ * @param size Set to the size of the block on success.
+ * @return true if block lies in the bumped part of a tail that has not been
+ * absorbed yet.
+ */
+static bool bump_lookup_size(Arena* a, void* block, size_t* size) {
+    if (atomic_load_explicit(&a->bumpAbsorbed, memory_order_acquire)) {
+        return false;
+    }
+    size_t off = block - a->base;
+    size_t top = atomic_load_explicit(&a->bumpTop, memory_order_relaxed);
+    if (off >= top || (off & ((1 << a->bumpShift) - 1))) return false;
+
+    size_t g = off >> a->bumpShift;
+    size_t lastWord = ((top - 1) >> a->bumpShift) / 64;
+    size_t w = g / 64;
+    uint64_t bits = __atomic_load_n(&a->bumpEnds[w], __ATOMIC_RELAXED);
+    bits &= ~0ULL << (g % 64);
+    while (bits == 0) {
+        if (++w > lastWord) return false;
+        bits = __atomic_load_n(&a->bumpEnds[w], __ATOMIC_RELAXED);
+    }
+
+    // The marks are dropped once the tail is absorbed, so a lookup racing
+    // with the absorb may have read cleared words
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&a->bumpAbsorbed, memory_order_relaxed)) {
+        return false;
+    }
+    *size = ((w * 64 + __builtin_ctzll(bits) + 1) << a->bumpShift) - off;
+    return true;
+}
+
+/**
+ * Orders pointers by address for qsort.
+ */
+static int compare_ptr(const void* x, const void* y) {
+    void* p = *(void* const*)x;
+    void* q = *(void* const*)y;
+    return (p > q) - (p < q);
+}
+
+/**
+ * Finds the start of the bumped block ending at the given offset, from the
+ * end mark of the block before it.
+ *
+ * @param a The arena.
+ * @param end The end offset of a bumped block.
+ * @return The start offset of the block.
+ */
+static size_t bump_block_start(Arena* a, size_t end) {
+    size_t g = (end >> a->bumpShift) - 1;
+    size_t w = g / 64;
+    uint64_t bits = a->bumpEnds[w] & ((1ULL << (g % 64)) - 1);
+    while (bits == 0 && w > 0) bits = a->bumpEnds[--w];
+    if (bits == 0) return 0;
+    return (w * 64 + 64 - __builtin_clzll(bits)) << a->bumpShift;
+}
+
+/**
+ * Hands the untouched tail of an arena and every block bumped off it to the
+ * engine. Further bumps fail, and blocks are then placed by the engine only.
+ * The caller must hold the arena lock.
+ *
+ * @param a The arena.
+ * @return true if the tail has been absorbed, false if the records for its
+ * blocks could not be set aside, in which case the tail stays open.
+ */
+static bool bump_absorb(Arena* a) {
+    const Engine* engine = a->pool->engine;
+    if (atomic_load_explicit(&a->bumpAbsorbed, memory_order_relaxed)) {
+        return true;
+    }
+
+    // Close the tail, then wait for bumps already past the check to mark
+    // their blocks
+    size_t top = atomic_exchange_explicit(&a->bumpTop, a->bumpLimit,
+                                          memory_order_relaxed);
+    while (atomic_load_explicit(&a->bumpCommitted, memory_order_acquire) !=
+           top) {
+        sched_yield();
+    }
+
+    // A live block the engine failed to record would later be handed out
+    // again, so every record and index slot the adopts may take is set aside
+    // first: one per block, and one per free range between them.
+    size_t blocks = 0;
+    for (size_t end = top; end > 0; end = bump_block_start(a, end)) blocks++;
+    if (!node_reserve(a, 2 * blocks + 1) || !index_reserve(a, blocks)) {
+        atomic_store_explicit(&a->bumpTop, top, memory_order_relaxed);
+        return false;
+    }
+
+    // Only the committed part of the tail goes to the engine; the rest is
+    // handed over by arena_extend as the engine runs out of room
+    size_t freeEnd = atomic_load_explicit(&a->committed, memory_order_relaxed);
+    if (freeEnd > a->size) freeEnd = a->size;
+    freeEnd &= ~(engine->granule - 1);
+    a->engineLimit = freeEnd;
+
+    // Engines link adopted ranges at the head of their lists, so ranges are
+    // handed over from the top of the arena down. Neighbouring free blocks
+    // are merged into the rest of the tail.
+    if (a->bumpFreedCount > 0) {
+        qsort(a->bumpFreed, a->bumpFreedCount, sizeof(void*), compare_ptr);
+    }
+    size_t f = a->bumpFreedCount;
+    size_t freeStart = top;
+    for (size_t end = top; end > 0;) {
+        size_t start = bump_block_start(a, end);
+        while (f > 0 && a->bumpFreed[f - 1] > a->base + start) f--;
+
+        if (f > 0 && a->bumpFreed[f - 1] == a->base + start) {
+            freeStart = start;
+        } else {
+            if (freeStart < freeEnd) {
+                engine->adopt(a, a->base + freeStart, a->base + freeEnd, false);
+            }
+            engine->adopt(a, a->base + start, a->base + end, true);
+            freeStart = freeEnd = start;
+        }
+        end = start;
+    }
+    if (freeStart < freeEnd) {
+        engine->adopt(a, a->base + freeStart, a->base + freeEnd, false);
+    }
+
+    free(a->bumpFreed);
+    a->bumpFreed = NULL;
+    a->bumpFreedCount = 0;
+    a->bumpFreedCapacity = 0;
+    atomic_store_explicit(&a->bumpAbsorbed, true, memory_order_release);
+
+    // The marks are dead now. Their pages are given back, but stay mapped
+    // for lookups that have not seen the absorb yet; those read zeros.
+    madvise(a->bumpEnds, a->bumpEndsSize, MADV_DONTNEED);
+    return true;
+}
+
+/**
+ * Commits the next stretch of an arena past the part its engine manages and
+ * hands it to the engine, so that the engine's metadata and the pages it
+ * touches grow with its high-water mark rather than with the arena. The
+ * stretch ends on a commit chunk boundary and leaves room for at least the
+ * given size. The caller must hold the arena lock.
+ *
+ * @param a The arena, with its tail absorbed.
+ * @param size The size of the block the engine could not place.
+ * @return true if the engine was handed more of the arena.
+ */
+static bool arena_extend(Arena* a, size_t size) {
+    const Engine* engine = a->pool->engine;
+    size_t limit = a->size & ~(engine->granule - 1);
+    if (a->engineLimit >= limit) return false;
+
+    size_t target = size < limit - a->engineLimit ? a->engineLimit + size
+                                                    : limit;
+    target = (target + COMMIT_CHUNK - 1) & ~(COMMIT_CHUNK - 1);
+    if (target > limit) target = limit;
+    if (!arena_commit(a, a->base + target)) return false;
+
+    size_t old = a->engineLimit;
+    a->engineLimit = target;
+    if (!engine->adopt(a, a->base + old, a->base + target, false)) {
+        a->engineLimit = old;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Adds a bumped block to the list of blocks freed before the tail is
+ * absorbed. The caller must hold the arena lock.
+ *
+ * @param a The arena.
+ * @param block A pointer to the block.
+ * @return true on success, false if the list could not be grown.
+ */
+static bool bump_record_free(Arena* a, void* block) {
+    if (a->bumpFreedCount == a->bumpFreedCapacity) {
+        size_t capacity = a->bumpFreedCapacity ? a->bumpFreedCapacity * 2 : 64;
+        void** freed = realloc(a->bumpFreed, capacity * sizeof(void*));
+        if (!freed) return false;
+        a->bumpFreed = freed;
+        a->bumpFreedCapacity = capacity;
+    }
+    a->bumpFreed[a->bumpFreedCount++] = block;
+    return true;
+}
+
+/**
+ * Records that a bumped block was freed before the tail was absorbed. The
+ * block is reused once the engine takes over the tail. The caller must hold
+ * the arena lock.
+ *
+ * @param a The arena.
+ * @param block A pointer to the block to free.
+ * @return true if block was bumped off a tail that has not been absorbed.
+ */
+static bool bump_free(Arena* a, void* block) {
+    if (atomic_load_explicit(&a->bumpAbsorbed, memory_order_relaxed)) {
+        return false;
+    }
+    size_t off = block - a->base;
+    if (off >= atomic_load_explicit(&a->bumpTop, memory_order_relaxed)) {
+        return false;
+    }
+
+    if (!bump_record_free(a, block)) {
+        // Let the engine take the block back instead. If the tail cannot be
+        // absorbed either, the block stays allocated until the pool is reset.
+        if (!bump_absorb(a)) return true;
+        Node* node = index_find(a, block);
+        if (node != NULL && !node->free) a->pool->engine->free(a, node);
+    }
+    return true;
+}
+
+/**
+ * Resizes a bumped block in place before the tail is absorbed. The last block
+ * bumped grows and shrinks by moving the top of the tail. Any other block
+ * shrinks by splitting its tail off as a freed block of its own. The caller
+ * must hold the arena lock.
+ *
+ * @param a The arena.
+ * @param block A pointer to the bumped block.
+ * @param oldSize The current size of the block.
+ * @param size The new size of the block.
+ * @return block if it was resized in place, or NULL if it must be resized by
+ * the engine.
+ */
+static void* bump_resize(Arena* a, void* block, size_t oldSize, size_t size) {
+    size_t unit = (size_t)1 << a->bumpShift;
+    size_t need = (size + unit - 1) & ~(unit - 1);
+    size_t off = block - a->base;
+    size_t end = off + oldSize;
+    size_t oldLast = (end - 1) >> a->bumpShift;
+    size_t newLast = (off + need - 1) >> a->bumpShift;
+    size_t top = end;
+    if (need == oldSize) return block;
+
+    if (need < oldSize) {
+        // Move the end mark before the top, so a block bumped right after the
+        // new top never finds the old mark inside itself
+        bump_mark(a, newLast, true);
+        bump_mark(a, oldLast, false);
+        if (atomic_compare_exchange_strong_explicit(
+                &a->bumpTop, &top, off + need, memory_order_relaxed,
+                memory_order_relaxed)) {
+            atomic_fetch_sub_explicit(&a->bumpCommitted, oldSize - need,
+                                      memory_order_relaxed);
+            return block;
+        }
+
+        // Not the last block; split the tail off as a freed block
+        bump_mark(a, oldLast, true);
+        if (!bump_record_free(a, block + need)) {
+            bump_mark(a, newLast, false);
+            return NULL;
+        }
+        return block;
+    }
+
+    if (need - oldSize > a->bumpLimit - end ||
+        !arena_commit(a, a->base + off + need) ||
+        !atomic_compare_exchange_strong_explicit(&a->bumpTop, &top, off + need,
+                                                 memory_order_relaxed,
+                                                 memory_order_relaxed)) {
+        return NULL;
+    }
+    bump_mark(a, newLast, true);
+    bump_mark(a, oldLast, false);
+    atomic_fetch_add_explicit(&a->bumpCommitted, need - oldSize,
+                              memory_order_relaxed);
+    return block;
+}
+
+/**
+ * Finds the run holding an address in a run map. Fields are read atomically so
+ * the search may race with changes to the map, as long as the caller checks
+ * the index sequence number afterwards.
+ *
+ * @param map The run map.
+ * @param count The number of runs in the map.
+ * @param addr The address to look up.
+ * @return The run holding addr, or NULL if addr is not in a run.
+ */
+static Run* run_search(Run** map, size_t count, void* addr) {
+    size_t lo = 0;
+    size_t hi = count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        Run* run = __atomic_load_n(&map[mid], __ATOMIC_RELAXED);
+        if (__atomic_load_n(&run->start, __ATOMIC_RELAXED) <= addr) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == 0) return NULL;
+
+    Run* run = __atomic_load_n(&map[lo - 1], __ATOMIC_RELAXED);
+    return addr < __atomic_load_n(&run->end, __ATOMIC_RELAXED) ? run : NULL;
+}
+
+/**
+ * Looks up the slot size of a tiny block without taking the arena lock.
+ *
+ * @param a The arena.
+ * @param addr The address of the slot.
+ * @param size Set to the slot size on success.
+ * @return true if addr is the start of a slot.
+ */
+static bool run_lookup_size(Arena* a, void* addr, size_t* size) {
+    for (;;) {
+        unsigned seq = index_read_begin(a);
+
+        // Like the index, the count is loaded before the map it indexes
+        size_t count = __atomic_load_n(&a->runMapCount, __ATOMIC_ACQUIRE);
+        Run** map = __atomic_load_n(&a->runMap, __ATOMIC_ACQUIRE);
+        Run* run = map ? run_search(map, count, addr) : NULL;
+        size_t slotSize = 0;
+        void* start = NULL;
+        if (run != NULL) {
+            slotSize = __atomic_load_n(&run->slotSize, __ATOMIC_RELAXED);
+            start = __atomic_load_n(&run->start, __ATOMIC_RELAXED);
+        }
+
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&a->indexSeq, memory_order_relaxed) != seq) {
+            continue;
+        }
+        if (run == NULL || (size_t)(addr - start) % slotSize != 0) return false;
+        *size = slotSize;
+        return true;
+    }
+}
+
+/**
+ * Adds a run to the run map. Lock-free lookups may search the map while it
+ * changes, so its entries are moved one at a time with atomic stores.
+ *
+ * @param a The arena.
+ * @param run The run to add.
+ * @return true on success, false if the map could not be grown.
+ */
+static bool run_map_insert(Arena* a, Run* run) {
+    if (a->runMapCount == a->runMapCapacity) {
+        size_t capacity = a->runMapCapacity ? a->runMapCapacity * 2 : 16;
+        Run** map = malloc(capacity * sizeof(Run*));
+        RetiredTable* retired = a->runMap ? malloc(sizeof(RetiredTable)) : NULL;
+        if (!map || (a->runMap && !retired)) {
+            free(map);
+            free(retired);
+            return false;
+        }
+        if (a->runMapCount > 0) {
+            memcpy(map, a->runMap, a->runMapCount * sizeof(Run*));
+        }
+        if (retired) {
+            retired->table = a->runMap;
+            retired->next = a->retiredTables;
+            a->retiredTables = retired;
+        }
+        index_write_begin(a);
+        __atomic_store_n(&a->runMap, map, __ATOMIC_RELEASE);
+        index_write_end(a);
+        a->runMapCapacity = capacity;
+    }
+
+    size_t i = a->runMapCount;
+    while (i > 0 && a->runMap[i - 1]->start > run->start) i--;
+    index_write_begin(a);
+    for (size_t j = a->runMapCount; j > i; j--) {
+        __atomic_store_n(&a->runMap[j], a->runMap[j - 1], __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&a->runMap[i], run, __ATOMIC_RELAXED);
+    __atomic_store_n(&a->runMapCount, a->runMapCount + 1, __ATOMIC_RELEASE);
+    index_write_end(a);
+    return true;
+}
+
+/**
+ * Removes a run from the run map. See run_map_insert.
+ *
+ * @param a The arena.
+ * @param run The run to remove. It must be in the map.
+ */
+static void run_map_remove(Arena* a, Run* run) {
+    size_t i = 0;
+    while (a->runMap[i] != run) i++;
+    index_write_begin(a);
+    for (size_t j = i + 1; j < a->runMapCount; j++) {
+        __atomic_store_n(&a->runMap[j - 1], a->runMap[j], __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&a->runMapCount, a->runMapCount - 1, __ATOMIC_RELAXED);
+    index_write_end(a);
+}
+
+/**
+ * Links a run into the list of runs with free slots of its size.
+ *
+ * @param a The arena.
+ * @param run The run to link.
+ */
+static void run_link(Arena* a, Run* run) {
+    Run** list = &a->tinyRuns[run->slotSize / TINY_STEP - 1];
+    run->prev = NULL;
+    run->next = *list;
+    if (run->next) run->next->prev = run;
+    *list = run;
+}
+
+/**
+ * Unlinks a run from the list of runs with free slots of its size.
+ *
+ * @param a The arena.
+ * @param run The run to unlink.
+ */
+static void run_unlink(Arena* a, Run* run) {
+    if (run->prev) {
+        run->prev->next = run->next;
+    } else {
+        a->tinyRuns[run->slotSize / TINY_STEP - 1] = run->next;
+    }
+    if (run->next) run->next->prev = run->prev;
+}
+
+/**
+ * Gives the free pages of an arena back to the kernel. Until the tail is
+ * absorbed, other threads bump blocks off it without the lock, so only the
+ * blocks freed from it are released, with neighbouring ones merged. The
+ * caller must hold the arena lock.
+ *
+ * @param a The arena.
+ * @return The number of bytes given back.
+ */
+static size_t arena_trim(Arena* a) {
+    a->trimPending = 0;
+    if (atomic_load_explicit(&a->bumpAbsorbed, memory_order_relaxed)) {
+        return a->pool->engine->purge(a);
+    }
+
+    if (a->bumpFreedCount > 0) {
+        qsort(a->bumpFreed, a->bumpFreedCount, sizeof(void*), compare_ptr);
+    }
+    size_t released = 0;
+    void* start = NULL;
+    void* end = NULL;
+    for (size_t i = 0; i < a->bumpFreedCount; i++) {
+        size_t size;
+        if (!bump_lookup_size(a, a->bumpFreed[i], &size)) continue;
+        if (a->bumpFreed[i] != end) {
+            released += purge_range(a, start, end);
+            start = a->bumpFreed[i];
+        }
+        end = a->bumpFreed[i] + size;
+    }
+    return released + purge_range(a, start, end);
+}
+
+/**
+ * Allocates a block of the arena for the lock holder, from the untouched tail
+ * while there is one and from the engine otherwise.
+ *
+ * @param a The arena.
+ * @param size The size of the memory block to allocate.
+ * @return A pointer to the allocated memory block, or NULL if the allocation
+ * fails.
+ */
+static void* alloc_locked(Arena* a, size_t size) {
+    size_t unit = (size_t)1 << a->bumpShift;
+    void* block = bump_alloc(a, (size + unit - 1) & ~(unit - 1));
+    if (block) return block;
+
+    if (!bump_absorb(a)) return NULL;
+    block = a->pool->engine->alloc(a, size);
+    while (!block && arena_extend(a, size)) {
+        block = a->pool->engine->alloc(a, size);
+    }
+    return block;
+}
+
+/**
+ * Frees a block of the arena that is not a tiny slot.
+ *
+ * @param a The arena.
+ * @param block A pointer to the block to free.
+ */
+static void free_locked(Arena* a, void* block) {
+    Node* curr = index_find(a, block);
+    size_t size = 0;
+    if (curr != NULL && !curr->free) {
+        size = curr->end - curr->start;
+        a->pool->engine->free(a, curr);
+    } else if (curr == NULL) {
+        if (a->pool->trimThreshold) bump_lookup_size(a, block, &size);
+        bump_free(a, block);
+    }
+    size_t threshold = a->pool->trimThreshold;
+    if (threshold && (a->trimPending += size) >= threshold) {
+        arena_trim(a);
+    }
+}
+
+/**
+ * Allocates a block of the arena aligned beyond the pool's minimum alignment,
+ * for the lock holder. A block padded by the most the alignment can cost is
+ * placed as usual, then the padding before the aligned address is split off
+ * and freed, and the block is shrunk to the requested size. Only the padding
+ * of the one block is ever held, and only while it is being placed.
+ *
+ * @param a The arena.
+ * @param size The size of the memory block to allocate, a multiple of the
+ * pool's minimum alignment.
+ * @param align The alignment of the block, a power of two larger than the
+ * pool's minimum alignment.
+ * @return A pointer to the allocated memory block, or NULL if the allocation
+ * fails.
+ */
+static void* aligned_locked(Arena* a, size_t size, size_t align) {
+    const Engine* engine = a->pool->engine;
+    size_t unit = engine->granule > a->pool->align ? engine->granule
+                                                   : a->pool->align;
+    if (align <= unit) return alloc_locked(a, size);
+    if (size > a->size || align - unit > a->size - size) return NULL;
+
+    void* block = alloc_locked(a, size + align - unit);
+    if (block == NULL) return NULL;
+
+    void* aligned = (void*)(((uintptr_t)block + align - 1) &
+                            ~(uintptr_t)(align - 1));
+    Node* node = index_find(a, block);
+    if (aligned != block) {
+        if (node == NULL) {
+            // Still on the untouched tail, where an end mark splits the block
+            bump_mark(a, (aligned - a->base - 1) >> a->bumpShift, true);
+        } else if (!engine->split(a, node, aligned - block)) {
+            free_locked(a, block);
+            return NULL;
+        }
+        free_locked(a, block);
+        node = node ? index_find(a, aligned) : NULL;
+    }
+
+    // Give back the padding the block did not need after all
+    size_t blockSize;
+    if (node != NULL) {
+        engine->resize(a, node, size);
+    } else if (bump_lookup_size(a, aligned, &blockSize)) {
+        bump_resize(a, aligned, blockSize, size);
+    }
+    return aligned;
+}
+
+/**
+ * Rounds a tiny request up to its slot size. Slots are whole granules of the
+ * engine, so a run can always be split into its slots.
+ *
+ * @param pool The pool.
+ * @param size The size of a tiny request.
+ * @return The slot size.
+ */
+static size_t tiny_size(mm_pool_t* pool, size_t size) {
+    size_t granule = pool->engine->granule;
+    size_t step = granule > TINY_STEP ? granule : TINY_STEP;
+    return (size + step - 1) & ~(step - 1);
+}
+
+/**
+ * Creates a run for the given slot size, with as many slots as the arena can
+ * supply up to 64.
+ *
+ * @param a The arena.
+ * @param slotSize The slot size, a multiple of TINY_STEP.
+ * @return The new run, or NULL if no run of TINY_RUN_MIN slots fits.
+ */
+static Run* run_create(Arena* a, size_t slotSize) {
+    if (a->freeRuns == NULL) {
+        RunChunk* chunk = malloc(sizeof(RunChunk));
+        if (!chunk) return NULL;
+        chunk->next = a->runChunks;
+        a->runChunks = chunk;
+        for (int i = RUN_CHUNK_SIZE - 1; i >= 0; i--) {
+            chunk->runs[i].next = a->freeRuns;
+            a->freeRuns = &chunk->runs[i];
+        }
+    }
+
+    for (size_t count = 64; count >= TINY_RUN_MIN; count /= 2) {
+        if (count * slotSize > a->size / TINY_RUN_SHARE) continue;
+        void* start = alloc_locked(a, count * slotSize);
+        if (!start) continue;
+
+        Run* run = a->freeRuns;
+        // Lookups may still read the record from its last use
+        __atomic_store_n(&run->start, start, __ATOMIC_RELAXED);
+        __atomic_store_n(&run->end, start + count * slotSize,
+                         __ATOMIC_RELAXED);
+        __atomic_store_n(&run->slotSize, slotSize, __ATOMIC_RELAXED);
+        run->allSlots = count == 64 ? ~0ULL : (1ULL << count) - 1;
+        run->freeSlots = run->allSlots;
+        if (!run_map_insert(a, run)) {
+            free_locked(a, start);
+            return NULL;
+        }
+        a->freeRuns = run->next;
+        run_link(a, run);
+        return run;
+    }
+    return NULL;
+}
+
+/**
+ * Returns an empty run to the arena.
+ *
+ * @param a The arena.
+ * @param run The run to release.
+ */
+static void run_release(Arena* a, Run* run) {
+    run_unlink(a, run);
+    run_map_remove(a, run);
+    free_locked(a, run->start);
+    run->next = a->freeRuns;
+    a->freeRuns = run;
+}
+
+/**
+ * Turns a run back into ordinary blocks, one per used slot,
+ * and frees the rest. Slots are split off the top one at a time; if records
+ * run out, the slots not yet split off stay a smaller run.
+ *
+ * @param a The arena.
+ * @param run The run to dissolve.
+ */
+static void run_dissolve(Arena* a, Run* run) {
+    const Engine* engine = a->pool->engine;
+    size_t count = (run->end - run->start) / run->slotSize;
+    size_t kept = count;
+    Node* node = index_find(a, run->start);
+    if (node == NULL) {
+        // Still on the untouched tail, where an end mark per slot is enough
+        size_t off = run->start - a->base;
+        for (; kept > 1; kept--) {
+            bump_mark(a, (off + (kept - 1) * run->slotSize - 1) >> a->bumpShift,
+                      true);
+        }
+    } else {
+        while (kept > 1 && engine->split(a, node, (kept - 1) * run->slotSize)) {
+            kept--;
+        }
+    }
+
+    uint64_t freeSlots = run->freeSlots;
+    if (freeSlots != 0) run_unlink(a, run);
+    if (kept > 1) {
+        index_write_begin(a);
+        __atomic_store_n(&run->end, run->start + kept * run->slotSize,
+                         __ATOMIC_RELAXED);
+        index_write_end(a);
+        run->allSlots = (1ULL << kept) - 1;
+        run->freeSlots &= run->allSlots;
+        if (run->freeSlots != 0) run_link(a, run);
+    } else {
+        run_map_remove(a, run);
+        run->next = a->freeRuns;
+        a->freeRuns = run;
+        kept = 0;
+    }
+    for (size_t i = kept; i < count; i++) {
+        if (freeSlots & (1ULL << i)) {
+            free_locked(a, run->start + i * run->slotSize);
+        }
+    }
+}
+
+/**
+ * Gives the free slots of every run back to the arena, so a failed allocation
+ * can be retried with their space. Empty runs are freed whole.
+ *
+ * @param a The arena.
+ * @return true if any slot was given back.
+ */
+static bool tiny_flush(Arena* a) {
+    bool flushed = false;
+    for (int c = 0; c < TINY_CLASSES; c++) {
+        while (a->tinyRuns[c] != NULL) {
+            Run* run = a->tinyRuns[c];
+            if (run->freeSlots == run->allSlots) {
+                run_release(a, run);
+            } else {
+                run_dissolve(a, run);
+            }
+            flushed = true;
+        }
+    }
+    return flushed;
+}
+
+/**
+ * Allocates a tiny block from a run, creating a run if every run of its size
+ * is full. A free slot is found with a single bit scan.
+ *
+ * @param a The arena.
+ * @param size The size of the memory block, at most TINY_MAX.
+ * @return A pointer to the slot, or NULL if no run could be created or the
+ * pool places every block with its engine.
+ */
+static void* tiny_alloc(Arena* a, size_t size) {
+    if (a->pool->engineOnly) return NULL;
+    size_t slotSize = tiny_size(a->pool, size);
+    Run* run = a->tinyRuns[slotSize / TINY_STEP - 1];
+    if (run == NULL) run = run_create(a, slotSize);
+    if (run == NULL) return NULL;
+
+    int slot = __builtin_ctzll(run->freeSlots);
+    run->freeSlots &= run->freeSlots - 1;
+    if (run->freeSlots == 0) run_unlink(a, run);
+    return run->start + slot * slotSize;
+}
+
+/**
+ * Frees a tiny block by setting its bit in the run holding it. A run that
+ * becomes empty is returned to the arena unless it is the only run of its size
+ * with free slots.
+ *
+ * @param a The arena.
+ * @param run The run holding the block.
+ * @param block A pointer to the block to free.
+ */
+static void tiny_free(Arena* a, Run* run, void* block) {
+    size_t off = block - run->start;
+    uint64_t bit = 1ULL << (off / run->slotSize);
+    if (off % run->slotSize != 0 || (run->freeSlots & bit)) return;
+
+    if (run->freeSlots == 0) run_link(a, run);
+    run->freeSlots |= bit;
+    if (run->freeSlots == run->allSlots &&
+        (run->prev != NULL || run->next != NULL)) {
+        run_release(a, run);
+    }
+}
+
+/**
+ * Frees a block of the arena, a tiny slot or not, for the lock holder.
+ *
+ * @param a The arena.
+ * @param block A pointer to the block to free.
+ */
+static void arena_free_locked(Arena* a, void* block) {
+    Run* run = run_search(a->runMap, a->runMapCount, block);
+    if (run != NULL) {
+        tiny_free(a, run, block);
+    } else {
+        free_locked(a, block);
+    }
+}
+
+/**
+ * Queues a block of the arena to be freed by the next thread that takes its
+ * lock, with a single compare-and-swap. The link is stored in the block, so
+ * blocks smaller than a pointer are not queued.
+ *
+ * @param a The arena.
+ * @param block A pointer to the block to free.
+ * @return true if the block was queued, false if it must be freed under the
+ * lock.
+ */
+static bool remote_push(Arena* a, void* block) {
+    size_t size;
+    if (!run_lookup_size(a, block, &size) &&
+        !bump_lookup_size(a, block, &size) &&
+        !index_lookup_size(a, block, &size)) {
+        return false;
+    }
+    if (size < sizeof(void*)) return false;
+
+    void* head = atomic_load_explicit(&a->remoteFree, memory_order_relaxed);
+    do {
+        memcpy(block, &head, sizeof(void*));
+    } while (!atomic_compare_exchange_weak_explicit(
+        &a->remoteFree, &head, block, memory_order_release,
+        memory_order_relaxed));
+    return true;
+}
+
+/**
+ * Frees every block queued for the arena. The whole queue is taken with one
+ * exchange, so pushes never contend with the drain beyond that. The caller
+ * must hold the arena lock.
+ *
+ * @param a The arena.
+ */
+static void remote_drain(Arena* a) {
+    if (atomic_load_explicit(&a->remoteFree, memory_order_relaxed) == NULL) {
+        return;
+    }
+    void* block =
+        atomic_exchange_explicit(&a->remoteFree, NULL, memory_order_acquire);
+    while (block != NULL) {
+        void* next;
+        memcpy(&next, block, sizeof(void*));
+        arena_free_locked(a, block);
+        block = next;
+    }
+}
+
+/**
+ * Takes the lock of an arena and frees the blocks queued for it meanwhile.
+ *
+ * @param a The arena.
+ */
+static void arena_lock(Arena* a) {
+    pthread_mutex_lock(&a->lock);
+    remote_drain(a);
+}
+
+/**
+ * Prepares an arena over a range of the pool or of a chunk. A pool that
+ * places every block with its engine gets an empty tail, so its first
+ * allocation hands the whole arena to the engine.
+ *
+ * @param pool The pool.
+ * @param a The arena, zeroed but for the end marks and buddy bitmaps of an
+ * earlier setup over the same range, which are cleared and reused if present.
+ * Setting up with both reused cannot fail.
+ * @param base The start of the range.
+ * @param size The size of the range.
+ * @param reserved true if the range must be committed before it is used.
+ * @return true on success, false if the end marks of the tail or the
+ * engine's metadata could not be mapped, in which case the arena must not be
+ * used.
+ */
+static bool arena_setup(mm_pool_t* pool, Arena* a, void* base, size_t size,
+                        bool reserved) {
+    // The whole arena starts out as untouched tail
+    size_t unit = pool->engine->granule > BUMP_UNIT ? pool->engine->granule
+                                                    : BUMP_UNIT;
+    size_t limit = size & ~(unit - 1);
+    size_t bytes = ((limit / unit) / 64 + 1) * sizeof(uint64_t);
+    uint64_t* ends = a->bumpEnds;
+    if (ends) {
+        madvise(ends, bytes, MADV_DONTNEED);
+    } else {
+        ends = metadata_map(bytes);
+        if (!ends) return false;
+    }
+
+    a->pool = pool;
+    a->base = base;
+    a->size = size;
+    if (!pool->engine->init(a)) {
+        if (ends != a->bumpEnds) munmap(ends, bytes);
+        return false;
+    }
+    pthread_mutex_init(&a->lock, NULL);
+    atomic_init(&a->committed, reserved ? 0 : size);
+    atomic_init(&a->remoteFree, NULL);
+    a->bumpShift = __builtin_ctzll(unit);
+    a->bumpLimit = pool->engineOnly ? 0 : limit;
+    a->bumpEnds = ends;
+    a->bumpEndsSize = bytes;
+    return true;
+}
+
+/**
+ * Releases everything an arena holds outside the pool.
+ *
+ * @param a The arena.
+ */
+static void arena_teardown(Arena* a) {
+    a->pool->engine->deinit(a);
+    NodeChunk* chunk = a->nodeChunks;
+    while (chunk != NULL) {
+        NodeChunk* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    RunChunk* runChunk = a->runChunks;
+    while (runChunk != NULL) {
+        RunChunk* next = runChunk->next;
+        free(runChunk);
+        runChunk = next;
+    }
+    free(a->runMap);
+    while (a->retiredTables != NULL) {
+        RetiredTable* next = a->retiredTables->next;
+        free(a->retiredTables->table);
+        free(a->retiredTables);
+        a->retiredTables = next;
+    }
+    free(a->blockIndex);
+    if (a->bumpEnds) munmap(a->bumpEnds, a->bumpEndsSize);
+    free(a->bumpFreed);
+    pthread_mutex_destroy(&a->lock);
+}
+
+/**
+ * Returns the number of arenas, those of the pool followed by those of the
+ * chunks it has grown by.
+ * @param pool The pool.
+ */
+static size_t arena_total(mm_pool_t* pool) {
+    return pool->arenaCount +
+           atomic_load_explicit(&pool->chunkCount, memory_order_acquire);
+}
+
+/**
+ * Returns an arena by its position among all arenas.
+ *
+ * @param pool The pool.
+ * @param i The position, less than arena_total().
+ * @return The arena.
+ */
+static Arena* arena_at(mm_pool_t* pool, size_t i) {
+    if (i < pool->arenaCount) return &pool->arenas[i];
+    return pool->chunkArenas[i - pool->arenaCount];
+}
+
+/**
+ * Finds the arena a pointer belongs to from its address. Pointers outside the
+ * pool are looked up among the chunks.
+ *
+ * @param pool The pool.
+ * @param ptr The pointer to look up.
+ * @return The arena containing ptr, or NULL if ptr lies outside the pool and
+ * every chunk.
+ */
+static Arena* arena_of(mm_pool_t* pool, void* ptr) {
+    if (ptr >= pool->memoryPool && ptr < pool->memoryPool + pool->memorySize) {
+        size_t i = (ptr - pool->memoryPool) / pool->arenaSpan;
+        return &pool->arenas[i < pool->arenaCount ? i : pool->arenaCount - 1];
+    }
+    size_t count =
+        atomic_load_explicit(&pool->chunkCount, memory_order_acquire);
+    for (size_t i = 0; i < count; i++) {
+        Arena* a = pool->chunkArenas[i];
+        if (ptr >= a->base && ptr < a->base + a->size) return a;
+    }
+    return NULL;
+}
+
+/**
+ * Returns the index of the calling thread's arena. In a NUMA pool that is the
+ * arena of the node the thread runs on. Otherwise threads are assigned to
+ * arenas round-robin on their first allocation.
+ *
+ * @param pool The pool.
+ * @return The index of the arena the thread allocates from first.
+ */
+static size_t thread_arena(mm_pool_t* pool) {
+    unsigned int cpu, node;
+    if (pool->numaNodes && getcpu(&cpu, &node) == 0 &&
+        node < pool->numaNodes) {
+        return node;
+    }
+    if (threadArena == 0) threadArena = atomic_fetch_add(&nextArena, 1) + 1;
+    return pool->arenaCount ? (threadArena - 1) % pool->arenaCount : 0;
+}
+
+/**
+ * Frees a block in the arena it belongs to. A block of another thread's arena,
+ * or of the thread's own arena while another thread holds its lock, is queued
+ * for the arena's next lock holder instead, so freeing never waits for the
+ * lock.
+ *
+ * @param pool The pool.
+ * @param block A pointer to the block to free.
+ */
+static void arena_free(mm_pool_t* pool, void* block) {
+    Arena* a = arena_of(pool, block);
+    if (a == NULL) return;
+
+    if (a == &pool->arenas[thread_arena(pool)] &&
+        pthread_mutex_trylock(&a->lock) == 0) {
+        remote_drain(a);
+    } else if (remote_push(a, block)) {
+        return;
+    } else {
+        arena_lock(a);
+    }
+    arena_free_locked(a, block);
+    pthread_mutex_unlock(&a->lock);
+}
+
+/**
+ * Allocates a block from one arena. Tiny requests may be served from runs.
+ * Other requests are tried on the untouched tail first, and through the
+ * engine under the lock once the tail is used up.
+ *
+ * @param a The arena.
+ * @param size The size of the memory block to allocate.
+ * @param align The alignment of the block, or 0 for the pool's minimum.
+ * @param slotted true if a tiny request may be served from a run.
+ * @return A pointer to the allocated memory block, or NULL if the arena has
+ * no room for it.
+ */
+static void* arena_try_alloc(Arena* a, size_t size, size_t align,
+                             bool slotted) {
+    if (size > a->size) return NULL;
+
+    void* block = NULL;
+    if (align > a->pool->align) {
+        arena_lock(a);
+        block = aligned_locked(a, size, align);
+        if (block == NULL && tiny_flush(a)) {
+            block = aligned_locked(a, size, align);
+        }
+        pthread_mutex_unlock(&a->lock);
+        return block;
+    }
+
+    if (slotted && size <= TINY_MAX) {
+        arena_lock(a);
+        block = tiny_alloc(a, size);
+        pthread_mutex_unlock(&a->lock);
+        if (block) return block;
+    }
+
+    size_t unit = (size_t)1 << a->bumpShift;
+    block = bump_alloc(a, (size + unit - 1) & ~(unit - 1));
+    if (block) return block;
+
+    arena_lock(a);
+    block = alloc_locked(a, size);
+    if (block == NULL && tiny_flush(a)) block = alloc_locked(a, size);
+    pthread_mutex_unlock(&a->lock);
+    return block;
+}
+
+/**
+ * Allocates a block from the calling thread's arena, or from the next arena
+ * with room if that one is full. The chunks the pool has grown by are tried
+ * last, oldest first.
+ *
+ * @param pool The pool.
+ * @param size The size of the memory block to allocate.
+ * @param align The alignment of the block, or 0 for the pool's minimum.
+ * @param slotted true if a tiny request may be served from a run. Blocks that
+ * must be movable on their own are never put in a run.
+ * @return A pointer to the allocated memory block, or NULL if no arena has
+ * room for it.
+ */
+static void* arena_alloc(mm_pool_t* pool, size_t size, size_t align,
+                         bool slotted) {
+    size_t first = thread_arena(pool);
+    for (size_t i = 0; i < pool->arenaCount; i++) {
+        void* block =
+            arena_try_alloc(&pool->arenas[(first + i) % pool->arenaCount],
+                            size, align, slotted);
+        if (block) return block;
+    }
+    size_t count =
+        atomic_load_explicit(&pool->chunkCount, memory_order_acquire);
+    for (size_t i = 0; i < count; i++) {
+        void* block =
+            arena_try_alloc(pool->chunkArenas[i], size, align, slotted);
+        if (block) return block;
+    }
+    return NULL;
+}
+
+/**
+ * Maps a chunk to grow the pool by and prepares its arena. The chunk is
+ * reserved and committed as it is used, like the default pool.
+ *
+ * @param pool The pool.
+ * @param size The usable size of the chunk.
+ * @return The arena of the chunk, or NULL if it could not be mapped.
+ */
+static Arena* chunk_create(mm_pool_t* pool, size_t size) {
+    size_t mapSize = pageSize + ((size + pageSize - 1) & ~(pageSize - 1));
+    void* map = mmap(NULL, mapSize, PROT_NONE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (map == MAP_FAILED) return NULL;
+
+    Arena* a = calloc(1, sizeof(Arena));
+    if (!a || !arena_setup(pool, a, map + pageSize, size, true)) {
+        free(a);
+        munmap(map, mapSize);
+        return NULL;
+    }
+    return a;
+}
+
+/**
+ * Grows the pool by a chunk for a request no arena could serve, as long as
+ * the pool stays within its ceiling. A chunk is at least as large as the
+ * initial pool, so a burst is absorbed by a few chunks.
+ *
+ * @param pool The pool.
+ * @param size The size of the memory block to allocate.
+ * @param align The alignment of the block, or 0 for the pool's minimum.
+ * @param slotted true if a tiny request may be served from a run.
+ * @return A pointer to the allocated memory block, or NULL if the pool cannot
+ * grow enough.
+ */
+static void* pool_grow(mm_pool_t* pool, size_t size, size_t align,
+                       bool slotted) {
+    if (pool->poolCeiling <= pool->memorySize) return NULL;
+
+    pthread_mutex_lock(&pool->growLock);
+    // Another thread may have grown the pool while this one waited
+    void* block = arena_alloc(pool, size, align, slotted);
+    size_t count =
+        atomic_load_explicit(&pool->chunkCount, memory_order_relaxed);
+    size_t pad = align > pool->align ? align - pool->align : 0;
+    size_t need = (size + pad + pageSize - 1) & ~(pageSize - 1);
+    size_t chunkSize = need > pool->memorySize ? need : pool->memorySize;
+    size_t room = pool->poolCeiling - pool->memorySize - pool->grownSize;
+    if (chunkSize > room) chunkSize = room;
+
+    if (block == NULL && count < POOL_CHUNK_MAX && chunkSize >= need) {
+        Arena* a = chunk_create(pool, chunkSize);
+        if (a) {
+            pool->chunkArenas[count] = a;
+            pool->grownSize += chunkSize;
+            atomic_store_explicit(&pool->chunkCount, count + 1,
+                                  memory_order_release);
+            block = arena_try_alloc(a, size, align, slotted);
+        }
+    }
+    pthread_mutex_unlock(&pool->growLock);
+    return block;
+}
+
+/**
+ * Resizes a block within the arena it belongs to.
+ *
+ * @param pool The pool.
+ * @param block A pointer to the block to resize.
+ * @param size The new size of the memory block.
+ * @param oldSize Receives the current size of the block if it was found.
+ * @return A pointer to the resized memory block, or NULL if the block was not
+ * found or its arena has no room.
+ */
+static void* arena_resize(mm_pool_t* pool, void* block, size_t size,
+                          size_t* oldSize) {
+    Arena* a = arena_of(pool, block);
+    if (a == NULL) return NULL;
+
+    arena_lock(a);
+    Run* run = run_search(a->runMap, a->runMapCount, block);
+    if (run != NULL) {
+        // A tiny block is moved unless the new size still fits its slot
+        *oldSize = run->slotSize;
+        void* newBlock = size <= run->slotSize ? block : NULL;
+        if (newBlock == NULL && size <= TINY_MAX) {
+            newBlock = tiny_alloc(a, size);
+        }
+        if (newBlock == NULL) newBlock = alloc_locked(a, size);
+        if (newBlock != NULL) {
+            if (newBlock != block) {
+                memcpy(newBlock, block, run->slotSize);
+                tiny_free(a, run, block);
+            }
+            pthread_mutex_unlock(&a->lock);
+            return newBlock;
+        }
+
+        // Dissolve the runs, so the block can be resized as any other block
+        tiny_flush(a);
+        run = run_search(a->runMap, a->runMapCount, block);
+        if (run != NULL) run_dissolve(a, run);
+        if (run_search(a->runMap, a->runMapCount, block) != NULL) {
+            pthread_mutex_unlock(&a->lock);
+            return NULL;
+        }
+    }
+
+    Node* walker = index_find(a, block);
+    if (walker == NULL && bump_lookup_size(a, block, oldSize)) {
+        void* resized = bump_resize(a, block, *oldSize, size);
+        if (resized != NULL) {
+            pthread_mutex_unlock(&a->lock);
+            return resized;
+        }
+        // A tail that cannot be absorbed leaves walker NULL, failing the resize
+        if (bump_absorb(a)) walker = index_find(a, block);
+    }
+    void* newBlock = NULL;
+    if (walker != NULL && !walker->free) {
+        *oldSize = walker->end - walker->start;
+        newBlock = pool->engine->resize(a, walker, size);
+        if (newBlock == NULL && tiny_flush(a)) {
+            newBlock = pool->engine->resize(a, walker, size);
+        }
+    }
+    pthread_mutex_unlock(&a->lock);
+    return newBlock;
+}
+
+/**
+ * Returns every block in a thread cache to its arena. The caller must hold
+ * tcacheLock and no arena lock.
+ *
+ * @param tc The cache to flush.
+ * @return true if any block was returned.
+ */
+static bool tcache_flush(ThreadCache* tc) {
+    bool flushed = false;
+    pthread_mutex_lock(&tc->lock);
+    for (size_t size = TCACHE_MIN_SIZE; size <= TCACHE_MAX_SIZE; size++) {
+        while (tc->bins[size] != NULL) {
+            void* block = tc->bins[size];
+            memcpy(&tc->bins[size], block, sizeof(void*));
+            arena_free(tc->pool, block);
+            flushed = true;
+        }
+        tc->counts[size] = 0;
+    }
+    pthread_mutex_unlock(&tc->lock);
+    return flushed;
+}
+
+/**
+ * Returns the blocks in every thread cache to their arenas, so an allocation
+ * that failed can be retried. The caller must not hold an arena lock.
+ *
+ * @param pool The pool.
+ * @return true if any block was returned.
+ */
+static bool flush_thread_caches(mm_pool_t* pool) {
+    if (!pool->tcacheEnabled) return false;
+
+    bool flushed = false;
+    pthread_mutex_lock(&pool->tcacheLock);
+    for (ThreadCache* tc = pool->tcaches; tc != NULL; tc = tc->next) {
+        if (tcache_flush(tc)) flushed = true;
+    }
+    for (size_t i = 0; pool->cpuCaches && i < pool->cpuCount; i++) {
+        if (tcache_flush(&pool->cpuCaches[i])) flushed = true;
+    }
+    pthread_mutex_unlock(&pool->tcacheLock);
+    return flushed;
+}
+
+/**
+ * Returns the cached blocks of an exiting thread to the pool and releases its
+ * cache. Called through the thread cache key destructor.
+ *
+ * @param arg The cache of the exiting thread.
+ */
+static void tcache_destroy(void* arg) {
+    ThreadCache* tc = arg;
+    mm_pool_t* pool = tc->pool;
+    pthread_mutex_lock(&pool->tcacheLock);
+    tcache_flush(tc);
+    if (tc->prev) tc->prev->next = tc->next;
+    else pool->tcaches = tc->next;
+    if (tc->next) tc->next->prev = tc->prev;
+    pthread_mutex_unlock(&pool->tcacheLock);
+    pthread_mutex_destroy(&tc->lock);
+    free(tc);
+}
+
+/**
+ * Returns the cache the calling thread keeps freed blocks in: the cache of the
+ * CPU it runs on with per-CPU locked caches, or its own cache otherwise.
+ *
+ * @param pool The pool.
+ * @param create true to create the thread's cache if it has none yet.
+ * @return The cache, or NULL if there is none.
+ */
+static ThreadCache* tcache_get(mm_pool_t* pool, bool create) {
+    if (pool->cpuCaches != NULL) {
+        int cpu = sched_getcpu();
+        if (cpu < 0 || (size_t)cpu >= pool->cpuCount) return NULL;
+        return &pool->cpuCaches[cpu];
+    }
+
+    ThreadCache* tc = pthread_getspecific(pool->tcacheKey);
+    if (tc != NULL || !create) return tc;
+    tc = calloc(1, sizeof(ThreadCache));
+    if (!tc) return NULL;
+    tc->pool = pool;
+    pthread_mutex_init(&tc->lock, NULL);
+    if (pthread_setspecific(pool->tcacheKey, tc) != 0) {
+        pthread_mutex_destroy(&tc->lock);
+        free(tc);
+        return NULL;
+    }
+    pthread_mutex_lock(&pool->tcacheLock);
+    tc->next = pool->tcaches;
+    if (pool->tcaches) pool->tcaches->prev = tc;
+    pool->tcaches = tc;
+    pthread_mutex_unlock(&pool->tcacheLock);
+    return tc;
+}
+
+/**
+ * Takes a block of the given size from the calling thread's cache.
+ *
+ * @param pool The pool.
+ * @param size The requested size.
+ * @return A pointer to a cached block, or NULL if there is none.
+ */
+static void* tcache_alloc(mm_pool_t* pool, size_t size) {
+    if (size <= TINY_MAX) {
+        size = tiny_size(pool, size);
+    } else {
+        size_t granule = pool->engine->granule;
+        size = (size + granule - 1) / granule * granule;
+    }
+    if (size < TCACHE_MIN_SIZE || size > TCACHE_MAX_SIZE) return NULL;
+
+    ThreadCache* tc = tcache_get(pool, false);
+    if (tc == NULL) return NULL;
+
+    pthread_mutex_lock(&tc->lock);
+    void* block = tc->bins[size];
+    if (block != NULL) {
+        memcpy(&tc->bins[size], block, sizeof(void*));
+        tc->counts[size]--;
+    }
+    pthread_mutex_unlock(&tc->lock);
+    return block;
+}
+
+/**
+ * Puts a freed block in the calling thread's cache, creating the cache on the
+ * thread's first free unless caches are per CPU.
+ *
+ * @param pool The pool.
+ * @param block The block to cache.
+ * @return true if the block was cached, false if it must be freed.
+ */
+static bool tcache_free(mm_pool_t* pool, void* block) {
+    Arena* a = arena_of(pool, block);
+    size_t size;
+    if (a == NULL) return false;
+    if (!run_lookup_size(a, block, &size) &&
+        !bump_lookup_size(a, block, &size) &&
+        !index_lookup_size(a, block, &size)) {
+        return false;
+    }
+    if (size < TCACHE_MIN_SIZE || size > TCACHE_MAX_SIZE) return false;
+
+    ThreadCache* tc = tcache_get(pool, true);
+    if (tc == NULL) return false;
+
+    pthread_mutex_lock(&tc->lock);
+    bool cached = tc->counts[size] < TCACHE_BIN_MAX;
+    if (cached) {
+        memcpy(block, &tc->bins[size], sizeof(void*));
+        tc->bins[size] = block;
+        tc->counts[size]++;
+    }
+    pthread_mutex_unlock(&tc->lock);
+    return cached;
+}
+
+/**
+ * Maps a pool aligned to a huge page. The mapping is made one huge page larger
+ * than needed, and the parts before the first and after the last aligned huge
+ * page are unmapped again.
+ *
+ * @param pool The pool.
+ * @param size The size of the pool.
+ * @return The pool, or NULL if it could not be mapped.
+ */
+static void* pool_map_aligned(mm_pool_t* pool, size_t size) {
+    size_t mapSize = (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+    void* map = mmap(NULL, mapSize + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) return NULL;
+
+    uintptr_t start = ((uintptr_t)map + HUGE_PAGE_SIZE - 1) &
+                      ~(uintptr_t)(HUGE_PAGE_SIZE - 1);
+    size_t head = start - (uintptr_t)map;
+    if (head) munmap(map, head);
+    munmap((void*)(start + mapSize), HUGE_PAGE_SIZE - head);
+
+#ifdef MADV_HUGEPAGE
+    // Only a hint; without transparent huge pages the pool uses small pages
+    madvise((void*)start, mapSize, MADV_HUGEPAGE);
+#endif
+    pool->poolMapSize = mapSize;
+    return (void*)start;
+}
+
+/**
+ * Allocates the pool with the requested kind of pages. Each kind falls back to
+ * the next more common one if the system cannot provide it: explicit huge
+ * pages to transparent huge pages, and those to malloc. Default pages are
+ * only reserved here and committed as the pool is used.
+ *
+ * @param pool The pool.
+ * @param size The size of the pool.
+ * @param pages The kind of pages to back the pool with.
+ * @return The pool, or NULL if it could not be allocated at all.
+ */
+static void* pool_create(mm_pool_t* pool, size_t size, mem_pages_t pages) {
+    pool->poolMapSize = 0;
+    pool->poolReserved = false;
+    long systemPageSize = sysconf(_SC_PAGESIZE);
+    pageSize = systemPageSize > 0 ? systemPageSize : 4096;
+    pool->poolPageSize = pageSize;
+    if (pool->align > pageSize) pool->align = pageSize;
+    if (size == 0) return malloc(size);
+
+#ifdef MAP_HUGETLB
+    if (pages == MEM_PAGES_HUGETLB) {
+        // Huge page mappings are aligned to the huge page size by the kernel
+        size_t mapSize = (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+        void* map = mmap(NULL, mapSize, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (map != MAP_FAILED) {
+            pool->poolMapSize = mapSize;
+            pool->poolPageSize = HUGE_PAGE_SIZE;
+            return map;
+        }
+    }
+#endif
+    if (pages != MEM_PAGES_DEFAULT) {
+        void* map = pool_map_aligned(pool, size);
+        if (map) return map;
+    } else {
+        size_t mapSize = (size + pageSize - 1) & ~(pageSize - 1);
+        void* map = mmap(NULL, mapSize, PROT_NONE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (map != MAP_FAILED) {
+            pool->poolMapSize = mapSize;
+            pool->poolReserved = true;
+            return map;
+        }
+    }
+    if (pool->align <= sizeof(max_align_t)) return malloc(size);
+    void* block;
+    return posix_memalign(&block, pool->align, size) == 0 ? block : NULL;
+}
+
+/**
+ * Counts the NUMA nodes the system may have, from the highest node id in
+ * sysfs.
+ *
+ * @return The number of nodes, 1 if they cannot be read.
+ */
+static size_t numa_node_count() {
+    FILE* file = fopen("/sys/devices/system/node/possible", "r");
+    if (!file) return 1;
+
+    // The list looks like "0" or "0-3" or "0,2-3"; the last number is the
+    // highest node id
+    size_t highest = 0;
+    unsigned long id;
+    int separator;
+    while (fscanf(file, "%lu", &id) == 1) {
+        highest = id;
+        separator = fgetc(file);
+        if (separator != ',' && separator != '-') break;
+    }
+    fclose(file);
+    return highest < NUMA_NODES_MAX ? highest + 1 : NUMA_NODES_MAX;
+}
+
+/**
+ * Binds each arena of a pool to the NUMA node of the same index, so its
+ * pages are taken from that node when first touched. The policy is preferred
+ * rather than strict, so a full node spills to the others instead of failing.
+ * Binding is best effort; arenas that cannot be bound are still used by the
+ * threads of their node.
+ *
+ * @param pool The pool, with one arena per node.
+ */
+static void numa_bind_arenas(mm_pool_t* pool) {
+    const size_t bits = 8 * sizeof(unsigned long);
+    for (size_t node = 0; node < pool->numaNodes; node++) {
+        Arena* a = &pool->arenas[node];
+        unsigned long mask[NUMA_NODES_MAX / (8 * sizeof(unsigned long))] = {0};
+        mask[node / bits] = 1UL << (node % bits);
+        size_t length = (a->size + pageSize - 1) & ~(pageSize - 1);
+        syscall(SYS_mbind, a->base, length, MPOL_PREFERRED, mask,
+                NUMA_NODES_MAX, 0);
+    }
+}
+
+/**
+ * Sets up one locked cache per CPU for a pool, so the number of caches is
+ * bounded by the number of CPUs however many threads there are. These are
+ * not rseq critical sections: a cache is picked by the CPU the thread runs on
+ * and guarded by its mutex, so a preempted or migrated thread only contends
+ * for the lock. The caches are only set up when the current CPU can be read
+ * with a plain load, that is with restartable sequences confirmed to be
+ * registered; sched_getcpu would be a system call on every cache access
+ * otherwise. Without them the pool caches nothing, and every free takes the
+ * locked arena path.
+ *
+ * @param pool The pool.
+ */
+static void pool_cpu_caches(mm_pool_t* pool) {
+#ifdef HAVE_RSEQ
+    bool registered = __rseq_size != 0;
+#else
+    bool registered = false;
+#endif
+    long count = sysconf(_SC_NPROCESSORS_CONF);
+    if (!registered || count <= 0 || sched_getcpu() < 0) return;
+
+    pool->cpuCaches = calloc(count, sizeof(ThreadCache));
+    if (!pool->cpuCaches) return;
+    pool->cpuCount = count;
+    for (size_t i = 0; i < pool->cpuCount; i++) {
+        pool->cpuCaches[i].pool = pool;
+        pthread_mutex_init(&pool->cpuCaches[i].lock, NULL);
+    }
+    pool->tcacheEnabled = true;
+}
+
+/**
+ * Sets up a pool with a given size and configuration.
+ *
+ * @param pool The pool to set up.
+ * @param size The size of the memory pool to allocate.
+ * @param config The configuration to use, or NULL for the defaults. The
+ * defaults can be overridden with the MM_ENGINE environment variable ("list",
+ * "tlsf" or "buddy"), the MM_ARENAS environment variable (the number of
+ * arenas), the MM_PAGES environment variable ("huge" or "hugetlb") and the
+ * MM_TRIM_THRESHOLD environment variable (bytes freed in an arena before it
+ * is trimmed), the MM_MAX_SIZE environment variable (the size the pool may
+ * grow to), the MM_ALIGN environment variable (the minimum alignment of
+ * every block), the MM_CPU_CACHES environment variable (1 for per-CPU
+ * locked caches) and the MM_NUMA environment variable (1 for an arena per NUMA
+ * node). The MM_POLICY environment variable ("first", "next", "best" or
+ * "worst") sets the placement policy whatever the configuration.
+ */
+static void pool_init(mm_pool_t* pool, size_t size,
+                      const mem_config_t* config) {
+    mem_config_t defaults = {.engine = MEM_ENGINE_LIST, .arenas = 1};
+    if (config == NULL) {
+        const char* name = getenv("MM_ENGINE");
+        if (name && strcmp(name, "tlsf") == 0) {
+            defaults.engine = MEM_ENGINE_TLSF;
+        }
+        if (name && strcmp(name, "buddy") == 0) {
+            defaults.engine = MEM_ENGINE_BUDDY;
+        }
+        const char* count = getenv("MM_ARENAS");
+        if (count) defaults.arenas = strtoul(count, NULL, 10);
+        const char* pages = getenv("MM_PAGES");
+        if (pages && strcmp(pages, "huge") == 0) {
+            defaults.pages = MEM_PAGES_HUGE;
+        }
+        if (pages && strcmp(pages, "hugetlb") == 0) {
+            defaults.pages = MEM_PAGES_HUGETLB;
+        }
+        const char* threshold = getenv("MM_TRIM_THRESHOLD");
+        if (threshold) defaults.trimThreshold = strtoul(threshold, NULL, 10);
+        const char* maxSize = getenv("MM_MAX_SIZE");
+        if (maxSize) defaults.maxSize = strtoull(maxSize, NULL, 10);
+        const char* align = getenv("MM_ALIGN");
+        if (align) defaults.align = strtoul(align, NULL, 10);
+        const char* cpuCaches = getenv("MM_CPU_CACHES");
+        if (cpuCaches) defaults.cpuCaches = atoi(cpuCaches) != 0;
+        const char* numa = getenv("MM_NUMA");
+        if (numa) defaults.numa = atoi(numa) != 0;
+        config = &defaults;
+    }
+
+    memset(pool, 0, sizeof(mm_pool_t));
+    switch (config->engine) {
+        case MEM_ENGINE_TLSF:
+            pool->engine = &tlsfEngine;
+            break;
+        case MEM_ENGINE_BUDDY:
+            pool->engine = &buddyEngine;
+            break;
+        default:
+            pool->engine = &listEngine;
+            break;
+    }
+
+    // MM_POLICY picks the placement policy without a code change
+    atomic_init(&pool->policy, atomic_load_explicit(&defaultPolicy,
+                                                    memory_order_relaxed));
+    static const char* policyNames[] = {"first", "next", "best", "worst"};
+    const char* policyName = getenv("MM_POLICY");
+    for (int i = 0; policyName && i < 4; i++) {
+        if (strcmp(policyName, policyNames[i]) == 0) mm_set_policy(pool, i);
+    }
+
+    pool->trimThreshold = config->trimThreshold;
+    pool->engineOnly = config->engineOnly;
+    pool->align = 1;
+    while (pool->align < config->align && pool->align < HUGE_PAGE_SIZE) {
+        pool->align <<= 1;
+    }
+    pool->memoryPool = pool_create(pool, size, config->pages);
+    pool->memorySize = pool->memoryPool ? size : 0;
+
+    // Every arena gets at least one unit, and every arena after the first
+    // starts at a multiple of the alignment, the engine granule and the bump
+    // unit. Arenas bound to NUMA nodes start on a page of their own.
+    size_t unit = pool->engine->granule > pool->align ? pool->engine->granule
+                                                      : pool->align;
+    if (unit < BUMP_UNIT) unit = BUMP_UNIT;
+    size_t arenaCount = config->arenas ? config->arenas : 1;
+    size_t nodes = config->numa && pool->poolMapSize ? numa_node_count() : 0;
+    if (nodes) {
+        arenaCount = nodes;
+        if (unit < pool->poolPageSize) unit = pool->poolPageSize;
+    }
+    if (pool->memorySize && arenaCount > pool->memorySize / unit) {
+        arenaCount = pool->memorySize / unit ? pool->memorySize / unit : 1;
+    }
+    pool->arenas = calloc(arenaCount, sizeof(Arena));
+    pool->arenaCount = pool->arenas ? arenaCount : 0;
+    pool->arenaSpan = pool->memorySize / arenaCount;
+    if (arenaCount > 1) pool->arenaSpan &= ~(unit - 1);
+    for (size_t i = 0; i < pool->arenaCount; i++) {
+        size_t arenaSize = i + 1 < pool->arenaCount
+                               ? pool->arenaSpan
+                               : pool->memorySize - i * pool->arenaSpan;
+        if (!arena_setup(pool, &pool->arenas[i],
+                         pool->memoryPool + i * pool->arenaSpan, arenaSize,
+                         pool->poolReserved)) {
+            // A pool missing an arena would lose its range, so it fails
+            while (i > 0) arena_teardown(&pool->arenas[--i]);
+            free(pool->arenas);
+            pool->arenas = NULL;
+            pool->arenaCount = 0;
+        }
+    }
+    if (nodes && pool->arenaCount == nodes) {
+        pool->numaNodes = nodes;
+        numa_bind_arenas(pool);
+    }
+
+    pool->poolCeiling = config->maxSize;
+    atomic_init(&pool->chunkCount, 0);
+    pthread_mutex_init(&pool->growLock, NULL);
+    pthread_mutex_init(&pool->handleLock, NULL);
+    pthread_mutex_init(&pool->tcacheLock, NULL);
+    if (config->engineOnly) {
+        // Nothing is cached
+    } else if (config->cpuCaches) {
+        pool_cpu_caches(pool);
+    } else {
+        pool->tcacheEnabled =
+            pthread_key_create(&pool->tcacheKey, tcache_destroy) == 0;
+    }
+}
+
+/**
+ * Frees every handle record of a pool, so the pool has no handles.
+ *
+ * @param pool The pool.
+ */
+static void pool_release_handles(mm_pool_t* pool) {
+    while (pool->handleChunks != NULL) {
+        HandleChunk* next = pool->handleChunks->next;
+        free(pool->handleChunks);
+        pool->handleChunks = next;
+    }
+    pool->freeHandles = NULL;
+    pool->handleCount = 0;
+}
+
+/**
+ * Unmaps every chunk a pool has grown by, so the pool is back to its initial
+ * size.
+ *
+ * @param pool The pool.
+ */
+static void pool_release_chunks(mm_pool_t* pool) {
+    size_t count =
+        atomic_load_explicit(&pool->chunkCount, memory_order_relaxed);
+    for (size_t i = 0; i < count; i++) {
+        Arena* a = pool->chunkArenas[i];
+        arena_teardown(a);
+        munmap(a->base - pageSize,
+               pageSize + ((a->size + pageSize - 1) & ~(pageSize - 1)));
+        free(a);
+    }
+    atomic_store_explicit(&pool->chunkCount, 0, memory_order_relaxed);
+    pool->grownSize = 0;
+}
+
+/**
+ * Releases a pool and everything that manages it, leaving it zeroed.
+ *
+ * @param pool The pool to release.
+ */
+static void pool_release(mm_pool_t* pool) {
+    if (pool->tcacheEnabled && !pool->cpuCaches) {
+        pthread_key_delete(pool->tcacheKey);
+    }
+    for (size_t i = 0; i < pool->cpuCount; i++) {
+        pthread_mutex_destroy(&pool->cpuCaches[i].lock);
+    }
+    free(pool->cpuCaches);
+    while (pool->tcaches != NULL) {
+        ThreadCache* next = pool->tcaches->next;
+        pthread_mutex_destroy(&pool->tcaches->lock);
+        free(pool->tcaches);
+        pool->tcaches = next;
+    }
+    pthread_mutex_destroy(&pool->tcacheLock);
+
+    pool_release_handles(pool);
+    pthread_mutex_destroy(&pool->handleLock);
+
+    pool_release_chunks(pool);
+    pthread_mutex_destroy(&pool->growLock);
+
+    for (size_t i = 0; i < pool->arenaCount; i++) {
+        arena_teardown(&pool->arenas[i]);
+    }
+    free(pool->arenas);
+    if (pool->poolMapSize) {
+        munmap(pool->memoryPool, pool->poolMapSize);
+    } else {
+        free(pool->memoryPool);
+    }
+    memset(pool, 0, sizeof(mm_pool_t));
+}
+
+/**
+ * Creates a pool of its own with a given size and configuration. Blocks of
+ * the pool must be freed and resized through the same pool.
+ *
+ * @param size The size of the memory pool to allocate.
+ * @param config The configuration to use, or NULL for the defaults, which the
+ * same environment variables as for mem_init_config override.
+ * @return The new pool, or NULL if it could not be created.
+ */
+mm_pool_t* mm_create_config(size_t size, const mem_config_t* config) {
+    mm_pool_t* pool = malloc(sizeof(mm_pool_t));
+    if (!pool) return NULL;
+
+    pool_init(pool, size, config);
+    if ((size && pool->memoryPool == NULL) || pool->arenaCount == 0) {
+        pool_release(pool);
+        free(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+/**
+ * Creates a pool of its own with a given size.
+ *
+ * @param size The size of the memory pool to allocate.
+ * @return The new pool, or NULL if it could not be created.
+ */
+mm_pool_t* mm_create(size_t size) {
+    return mm_create_config(size, NULL);
+}
+
+/**
+ * Destroys a pool created with mm_create. Its blocks, caches and handles
+ * become invalid.
+ *
+ * @param pool The pool to destroy.
+ */
+void mm_destroy(mm_pool_t* pool) {
+    if (!pool) return;
+    pool_release(pool);
+    free(pool);
+}
+
+/**
+ * Initializes the memory manager with a given size and configuration.
+ *
+ * @param size The size of the memory pool to allocate.
+ * @param config The configuration to use, or NULL for the defaults. See
+ * pool_init for the environment variables that override them.
+ */
+void mem_init_config(size_t size, const mem_config_t* config) {
+    pool_init(&defaultPool, size, config);
+}
+
+/**
+ * Initializes the memory manager with a given size.
+ *
+ * @param size The size of the memory pool to allocate.
+ */
+void mem_init(size_t size) {
+    mem_init_config(size, NULL);
+}
+
+/**
+ * Sets how the list engine of a pool chooses among the gaps that fit a
+ * request. The policy applies to blocks placed from then on. The TLSF and
+ * buddy engines place blocks their own way and ignore it.
+ *
+ * @param pool The pool.
+ * @param newPolicy The placement policy.
+ */
+void mm_set_policy(mm_pool_t* pool, mem_policy_t newPolicy) {
+    atomic_store_explicit(&pool->policy, newPolicy, memory_order_relaxed);
+}
+
+/**
+ * Sets the placement policy of the default pool. The policy stays in effect
+ * across mem_init until it is changed again, and pools created from then on
+ * start out with it.
+ *
+ * @param newPolicy The placement policy.
+ */
+void mem_set_policy(mem_policy_t newPolicy) {
+    atomic_store_explicit(&defaultPolicy, newPolicy, memory_order_relaxed);
+    mm_set_policy(&defaultPool, newPolicy);
+}
+
+/**
+ * Tells whether compacting a pool could make room for a block that failed to
+ * fit, so a failed allocation only pays for a compaction when it may help:
+ * handles must be in use and some arena must have enough free bytes between
+ * its blocks, though no gap is large enough.
+ *
+ * @param pool The pool.
+ * @param size The size of the block.
+ * @return true if compaction is worth trying.
+ */
+static bool pool_fragmented(mm_pool_t* pool, size_t size) {
+    if (pool->engine != &listEngine ||
+        __atomic_load_n(&pool->handleCount, __ATOMIC_RELAXED) == 0) {
+        return false;
+    }
+    for (size_t i = 0; i < arena_total(pool); i++) {
+        Arena* a = arena_at(pool, i);
+        arena_lock(a);
+        size_t spare = a->gapBytes + gap_after(a, NULL);
+        pthread_mutex_unlock(&a->lock);
+        if (spare >= size) return true;
+    }
+    return false;
+}
+
+/**
+ * Allocates a block of memory of the given size from a pool. Small blocks
+ * freed earlier by the calling thread are reused without taking a lock
+ * shared with other threads. A zero-size allocation returns the end of the
+ * pool, which is never the start of a block, so freeing it is a no-op.
+ *
+ * @param pool The pool.
+ * @param size The size of the memory block to allocate.
+ * @return A pointer to the allocated memory block, or NULL if the allocation
+ * fails.
+ */
+void* mm_alloc(mm_pool_t* pool, size_t size) {
+    if (size > pool->memorySize && size > pool->poolCeiling) return NULL;
+    if (size == 0) return pool->memoryPool + pool->memorySize;
+    size = (size + pool->align - 1) & ~(pool->align - 1);
+
+    if (pool->tcacheEnabled) {
+        void* cached = tcache_alloc(pool, size);
+        if (cached) return cached;
+    }
+
+    void* block = arena_alloc(pool, size, 0, true);
+    if (block == NULL && flush_thread_caches(pool)) {
+        block = arena_alloc(pool, size, 0, true);
+    }
+    if (block == NULL && pool_fragmented(pool, size) &&
+        mm_compact(pool) > 0) {
+        block = arena_alloc(pool, size, 0, true);
+    }
+    if (block == NULL) block = pool_grow(pool, size, 0, true);
+    return block;
+}
 
 /**
- * Initializes the memory manager with a given size.
+ * Allocates a block of memory of the given size from the default pool.
  *
- * @param size The size of the memory pool to allocate.
+ * @param size The size of the memory block to allocate.
+ * @return A pointer to the allocated memory block, or NULL if the allocation
+ * fails.
  */
-void mem_init(size_t size) {
-    memoryPool = malloc(size);
-    memorySize = size;
-    head = NULL;
-    pthread_mutex_init(&mLock, NULL);
+void* mem_alloc(size_t size) {
+    return mm_alloc(&defaultPool, size);
 }
 
 /**
- * Allocates a block of memory of the given size from the memory pool.
+ * Allocates a block of memory of a pool whose address is a multiple of the
+ * given alignment. Alignments up to the pool's minimum cost nothing over
+ * mm_alloc. Larger ones are placed with room for the worst case, and the
+ * room the block does not need is given back at once. The block keeps its
+ * alignment when it is resized in place, but not when it has to move.
  *
+ * @param pool The pool.
  * @param size The size of the memory block to allocate.
+ * @param align The alignment of the block, a power of two.
  * @return A pointer to the allocated memory block, or NULL if the allocation
- * fails.
+ * fails or align is not a power of two.
  */
-void* mem_alloc_no_lock(size_t size) {
-    if (size > memorySize) return NULL;
-    if (size == 0) return memoryPool;  // :(
+void* mm_alloc_aligned(mm_pool_t* pool, size_t size, size_t align) {
+    if (align == 0 || (align & (align - 1))) return NULL;
+    if (align <= pool->align || size == 0) return mm_alloc(pool, size);
+    size_t limit = pool->memorySize > pool->poolCeiling ? pool->memorySize
+                                                         : pool->poolCeiling;
+    if (size > limit || align > limit) return NULL;
+    size = (size + pool->align - 1) & ~(pool->align - 1);
 
-    Node* nodeToAdd = malloc(sizeof(Node));
-    if (!nodeToAdd) return NULL;
+    void* block = arena_alloc(pool, size, align, true);
+    if (block == NULL && flush_thread_caches(pool)) {
+        block = arena_alloc(pool, size, align, true);
+    }
+    if (block == NULL && pool_fragmented(pool, size) &&
+        mm_compact(pool) > 0) {
+        block = arena_alloc(pool, size, align, true);
+    }
+    if (block == NULL) block = pool_grow(pool, size, align, true);
+    return block;
+}
+
+/**
+ * Allocates a block of memory of the default pool whose address is a multiple
+ * of the given alignment.
+ *
+ * @param size The size of the memory block to allocate.
+ * @param align The alignment of the block, a power of two.
+ * @return A pointer to the allocated memory block, or NULL if the allocation
+ * fails or align is not a power of two.
+ */
+void* mem_alloc_aligned(size_t size, size_t align) {
+    return mm_alloc_aligned(&defaultPool, size, align);
+}
 
-    if (head == NULL || head->start - memoryPool >= size) {
-        nodeToAdd->start = memoryPool;
-        nodeToAdd->end = memoryPool + size;
-        nodeToAdd->next = head;
-        head = nodeToAdd;
-        return nodeToAdd->start;
+/**
+ * Allocates several blocks of a pool at once. Blocks the thread cache cannot
+ * serve are all placed in the calling thread's arena under a single hold of
+ * its lock; only those that arena has no room for are allocated one by one
+ * like mm_alloc does. Either every block is allocated or none is.
+ *
+ * @param pool The pool.
+ * @param sizes The sizes of the memory blocks to allocate.
+ * @param n The number of blocks.
+ * @param out Receives a pointer to each block, or NULL for every block if the
+ * allocation fails.
+ * @return true on success, false if any block could not be allocated.
+ */
+bool mm_alloc_batch(mm_pool_t* pool, const size_t* sizes, size_t n,
+                    void** out) {
+    size_t limit = pool->memorySize > pool->poolCeiling ? pool->memorySize
+                                                         : pool->poolCeiling;
+    size_t pending = 0;
+    for (size_t i = 0; i < n; i++) {
+        out[i] = NULL;
+        if (sizes[i] > limit) {
+            memset(out, 0, n * sizeof(void*));
+            return false;
+        }
+        size_t size = (sizes[i] + pool->align - 1) & ~(pool->align - 1);
+        if (size == 0) {
+            out[i] = pool->memoryPool + pool->memorySize;
+        } else if (pool->tcacheEnabled) {
+            out[i] = tcache_alloc(pool, size);
+        }
+        if (out[i] == NULL) pending++;
     }
 
-    Node* walker = head;
-    while (walker->next != NULL) {
-        if (walker->next->start - walker->end >= size) {
-            nodeToAdd->start = walker->end;
-            nodeToAdd->end = walker->end + size;
-            nodeToAdd->next = walker->next;
-            walker->next = nodeToAdd;
-            return nodeToAdd->start;
+    if (pending) {
+        Arena* a = &pool->arenas[thread_arena(pool)];
+        bool flushed = false;
+        arena_lock(a);
+        for (size_t i = 0; i < n; i++) {
+            size_t size = (sizes[i] + pool->align - 1) & ~(pool->align - 1);
+            if (out[i] != NULL || size > a->size) continue;
+            if (size <= TINY_MAX) out[i] = tiny_alloc(a, size);
+            if (out[i] == NULL) out[i] = alloc_locked(a, size);
+            if (out[i] == NULL && !flushed) {
+                flushed = true;
+                if (tiny_flush(a)) out[i] = alloc_locked(a, size);
+            }
         }
-        walker = walker->next;
+        pthread_mutex_unlock(&a->lock);
     }
 
-    if (memoryPool + memorySize - walker->end >= size) {
-        nodeToAdd->start = walker->end;
-        nodeToAdd->end = walker->end + size;
-        nodeToAdd->next = NULL;
-        walker->next = nodeToAdd;
-        return nodeToAdd->start;
+    // Whatever the thread's arena could not hold takes the usual way
+    for (size_t i = 0; i < n; i++) {
+        if (out[i] == NULL) out[i] = mm_alloc(pool, sizes[i]);
+        if (out[i] == NULL) {
+            mm_free_batch(pool, out, n);
+            memset(out, 0, n * sizeof(void*));
+            return false;
+        }
     }
+    return true;
+}
 
-    free(nodeToAdd);
-    return NULL;
+/**
+ * Allocates several blocks of the default pool at once.
+ *
+ * @param sizes The sizes of the memory blocks to allocate.
+ * @param n The number of blocks.
+ * @param out Receives a pointer to each block, or NULL for every block if the
+ * allocation fails.
+ * @return true on success, false if any block could not be allocated.
+ */
+bool mem_alloc_batch(const size_t* sizes, size_t n, void** out) {
+    return mm_alloc_batch(&defaultPool, sizes, n, out);
 }
 
-void* mem_alloc(size_t size) {
-    if (size > memorySize) return NULL;
-    if (size == 0) return memoryPool;  // :(
+/**
+ * Frees a previously allocated block of memory of a pool. Small blocks go to
+ * the calling thread's cache while the cache has room for them.
+ *
+ * @param pool The pool the block was allocated from.
+ * @param block A pointer to the memory block to free.
+ */
+void mm_free(mm_pool_t* pool, void* block) {
+    if (!block) return;
+    if (pool->tcacheEnabled && tcache_free(pool, block)) return;
 
-    Node* nodeToAdd = malloc(sizeof(Node));
-    if (!nodeToAdd) return NULL;
+    arena_free(pool, block);
+}
 
-    pthread_mutex_lock(&mLock);
+/**
+ * Frees a previously allocated block of memory of the default pool.
+ *
+ * @param block A pointer to the memory block to free.
+ */
+void mem_free(void* block) {
+    mm_free(&defaultPool, block);
+}
 
-    if (head == NULL || head->start - memoryPool >= size) {
-        nodeToAdd->start = memoryPool;
-        nodeToAdd->end = memoryPool + size;
-        nodeToAdd->next = head;
-        head = nodeToAdd;
+/**
+ * Frees several blocks of a pool at once. Blocks go to the calling thread's
+ * cache while it has room for them, as with mm_free. The rest are freed
+ * holding each arena's lock once for every run of blocks from that arena, in
+ * groups of up to 64 blocks, since the thread cache must not be touched with
+ * an arena lock held.
+ *
+ * @param pool The pool the blocks were allocated from.
+ * @param blocks Pointers to the memory blocks to free. NULL entries are
+ * skipped.
+ * @param n The number of blocks.
+ */
+void mm_free_batch(mm_pool_t* pool, void* const* blocks, size_t n) {
+    for (size_t first = 0; first < n; first += 64) {
+        size_t count = n - first < 64 ? n - first : 64;
+        uint64_t cached = 0;
+        for (size_t i = 0; pool->tcacheEnabled && i < count; i++) {
+            void* block = blocks[first + i];
+            if (block && tcache_free(pool, block)) cached |= 1ULL << i;
+        }
 
-        pthread_mutex_unlock(&mLock);
-        return nodeToAdd->start;
+        Arena* locked = NULL;
+        for (size_t i = 0; i < count; i++) {
+            void* block = blocks[first + i];
+            if (block == NULL || (cached & (1ULL << i))) continue;
+            Arena* a = arena_of(pool, block);
+            if (a == NULL) continue;
+            if (a != locked) {
+                if (locked) pthread_mutex_unlock(&locked->lock);
+                arena_lock(a);
+                locked = a;
+            }
+            arena_free_locked(a, block);
+        }
+        if (locked) pthread_mutex_unlock(&locked->lock);
     }
+}
 
-    Node* walker = head;
-    while (walker->next != NULL) {
-        if (walker->next->start - walker->end >= size) {
-            nodeToAdd->start = walker->end;
-            nodeToAdd->end = walker->end + size;
-            nodeToAdd->next = walker->next;
-            walker->next = nodeToAdd;
+/**
+ * Frees several blocks of the default pool at once.
+ *
+ * @param blocks Pointers to the memory blocks to free. NULL entries are
+ * skipped.
+ * @param n The number of blocks.
+ */
+void mem_free_batch(void* const* blocks, size_t n) {
+    mm_free_batch(&defaultPool, blocks, n);
+}
 
-            pthread_mutex_unlock(&mLock);
-            return nodeToAdd->start;
-        }
-        walker = walker->next;
+/**
+ * Resizes a previously allocated block of memory of a pool. Blocks shrink in
+ * place and grow in place whenever the space after them is free; the data is
+ * only copied when the block has to move. A block whose arena has no room
+ * for the new size is moved to another arena.
+ *
+ * @param pool The pool the block was allocated from.
+ * @param block A pointer to the memory block to resize.
+ * @param size The new size of the memory block.
+ * @return A pointer to the resized memory block, or NULL if the allocation
+ * fails.
+ */
+void* mm_resize(mm_pool_t* pool, void* block, size_t size) {
+    if (!block) {
+        return mm_alloc(pool, size);
     }
 
-    if (memoryPool + memorySize - walker->end >= size) {
-        nodeToAdd->start = walker->end;
-        nodeToAdd->end = walker->end + size;
-        nodeToAdd->next = NULL;
-        walker->next = nodeToAdd;
+    if (size == 0) {
+        mm_free(pool, block);
+        return NULL;
+    }
+    // A size too large to round cannot fit anyway
+    if (size <= SIZE_MAX - pool->align) {
+        size = (size + pool->align - 1) & ~(pool->align - 1);
+    }
 
-        pthread_mutex_unlock(&mLock);
-        return nodeToAdd->start;
+    size_t oldSize = 0;
+    void* newBlock = arena_resize(pool, block, size, &oldSize);
+    if (newBlock == NULL && oldSize != 0 && flush_thread_caches(pool)) {
+        newBlock = arena_resize(pool, block, size, &oldSize);
     }
+    if (newBlock != NULL || oldSize == 0) return newBlock;
 
-    free(nodeToAdd);
+    if (arena_total(pool) > 1) newBlock = arena_alloc(pool, size, 0, true);
+    if (!newBlock) newBlock = pool_grow(pool, size, 0, true);
+    if (!newBlock) return NULL;
+    memcpy(newBlock, block, (size < oldSize) ? size : oldSize);
+    arena_free(pool, block);
+    return newBlock;
+}
 
-    pthread_mutex_unlock(&mLock);
-    return NULL;
+/**
+ * Resizes a previously allocated block of memory of the default pool.
+ *
+ * @param block A pointer to the memory block to resize.
+ * @param size The new size of the memory block.
+ * @return A pointer to the resized memory block, or NULL if the allocation
+ * fails.
+ */
+void* mem_resize(void* block, size_t size) {
+    return mm_resize(&defaultPool, block, size);
+}
+
+/**
+ * Deinitializes the memory manager by freeing all allocated memory blocks and
+ * resetting the memory manager state.
+ */
+void mem_deinit() {
+    pool_release(&defaultPool);
 }
 
 /**
- * Frees a previously allocated block of memory.
+ * Frees every block of a pool at once, leaving the pool as it was when it was
+ * created. The pool keeps its mapping, its committed pages and its caches, so
+ * only the records kept outside the pool are dropped, a chunk of records at a
+ * time; that is much cheaper than releasing the pool and creating it again.
+ * Chunks the pool has grown by are unmapped. Blocks, handles, object caches
+ * and regions of the pool become invalid, and no other thread may use the
+ * pool during the reset.
  *
- * @param block A pointer to the memory block to free.
+ * @param pool The pool.
  */
-void mem_free(void* block) {
-    pthread_mutex_lock(&mLock);
-    if (!block || !head) {
-        pthread_mutex_unlock(&mLock);
-        return;
+void mm_reset(mm_pool_t* pool) {
+    // Cached blocks are dropped rather than freed into arenas about to be
+    // emptied
+    pthread_mutex_lock(&pool->tcacheLock);
+    for (ThreadCache* tc = pool->tcaches; tc != NULL; tc = tc->next) {
+        memset(tc->bins, 0, sizeof(tc->bins));
+        memset(tc->counts, 0, sizeof(tc->counts));
     }
+    for (size_t i = 0; i < pool->cpuCount; i++) {
+        ThreadCache* tc = &pool->cpuCaches[i];
+        memset(tc->bins, 0, sizeof(tc->bins));
+        memset(tc->counts, 0, sizeof(tc->counts));
+    }
+    pthread_mutex_unlock(&pool->tcacheLock);
 
-    Node* curr = head;
-    Node* prev = NULL;
+    pool_release_handles(pool);
+    pool_release_chunks(pool);
 
-    while (curr != NULL) {
-        if (curr->start == block) {
-            if (prev == NULL) {
-                head = curr->next;
-            } else {
-                prev->next = curr->next;
-            }
-            free(curr);
+    // Pages already committed stay accessible, so they are not committed
+    // again. The end marks and buddy bitmaps are cleared in place rather than
+    // mapped again, so setting the arena up again cannot fail.
+    for (size_t i = 0; i < pool->arenaCount; i++) {
+        Arena* a = &pool->arenas[i];
+        void* base = a->base;
+        size_t size = a->size;
+        size_t committed =
+            atomic_load_explicit(&a->committed, memory_order_relaxed);
+        uint64_t* ends = a->bumpEnds;
+        uint64_t* bitmaps = a->buddyBitmapStore;
+        size_t bitmapSize = a->buddyBitmapSize;
+        a->bumpEnds = NULL;
+        a->buddyBitmapStore = NULL;
+        arena_teardown(a);
+        memset(a, 0, sizeof(Arena));
+        a->bumpEnds = ends;
+        a->buddyBitmapStore = bitmaps;
+        a->buddyBitmapSize = bitmapSize;
+        arena_setup(pool, a, base, size, pool->poolReserved);
+        atomic_store_explicit(&a->committed, committed, memory_order_relaxed);
+    }
+}
 
-            pthread_mutex_unlock(&mLock);
-            return;
-        }
-        prev = curr;
-        curr = curr->next;
+/**
+ * Frees every block of the default pool at once. See mm_reset.
+ */
+void mem_reset() {
+    mm_reset(&defaultPool);
+}
+
+/**
+ * Gives the whole pages of free space in a pool back to the kernel, keeping
+ * the pool mapped. Thread caches are flushed first so their blocks count as
+ * free. Freed space is also trimmed automatically once an arena has had the
+ * configured threshold of bytes freed since its last trim.
+ *
+ * @param pool The pool.
+ * @return The number of bytes given back, including pages already given back
+ * by an earlier trim.
+ */
+size_t mm_trim(mm_pool_t* pool) {
+    flush_thread_caches(pool);
+    size_t released = 0;
+    for (size_t i = 0; i < arena_total(pool); i++) {
+        Arena* a = arena_at(pool, i);
+        arena_lock(a);
+        released += arena_trim(a);
+        pthread_mutex_unlock(&a->lock);
     }
-    pthread_mutex_unlock(&mLock);
+    return released;
 }
 
 /**
- * Resizes a previously allocated block of memory.
+ * Gives the whole pages of free space in the default pool back to the kernel.
  *
- * @param block A pointer to the memory block to resize.
- * @param size The new size of the memory block.
- * @return A pointer to the resized memory block, or NULL if the allocation
- * fails.
+ * @return The number of bytes given back.
  */
-void* mem_resize(void* block, size_t size) {
-    if (!block) {
-        return mem_alloc(size);
+size_t mem_trim() {
+    return mm_trim(&defaultPool);
+}
+
+/**
+ * Creates an object cache for objects of a fixed size. Objects are carved out
+ * of slabs allocated from a pool and recycled through a free list, so the
+ * general allocation path is only taken once per slab.
+ *
+ * @param pool The pool to take slabs from.
+ * @param size The size of each object.
+ * @param align The alignment of each object, a power of two. 0 means 1.
+ * @return A pointer to the new cache, or NULL if it could not be created.
+ */
+mem_cache_t* mm_cache_create(mm_pool_t* pool, size_t size, size_t align) {
+    if (size == 0) return NULL;
+    if (align == 0) align = 1;
+    if (align & (align - 1)) return NULL;
+
+    mem_cache_t* cache = malloc(sizeof(mem_cache_t));
+    if (!cache) return NULL;
+
+    // Free objects hold the free-list link, so they must fit a pointer
+    if (size < sizeof(void*)) size = sizeof(void*);
+    cache->pool = pool;
+    cache->objectSize = (size + align - 1) & ~(align - 1);
+    cache->align = align;
+    cache->freeObjects = NULL;
+    cache->slabs = NULL;
+    cache->slabCount = 0;
+    cache->slabCapacity = 0;
+    pthread_mutex_init(&cache->lock, NULL);
+    return cache;
+}
+
+/**
+ * Creates an object cache that takes its slabs from the default pool.
+ *
+ * @param size The size of each object.
+ * @param align The alignment of each object, a power of two. 0 means 1.
+ * @return A pointer to the new cache, or NULL if it could not be created.
+ */
+mem_cache_t* mem_cache_create(size_t size, size_t align) {
+    return mm_cache_create(&defaultPool, size, align);
+}
+
+/**
+ * Allocates a new slab for a cache and puts its objects on the free list. The
+ * slab holds up to SLAB_MAX_OBJECTS objects, fewer if the pool cannot supply a
+ * slab that large, so a cache can use a pool to its last object. The caller
+ * must hold the cache lock.
+ *
+ * @param cache The cache to grow.
+ * @return true if a slab was added.
+ */
+static bool mem_cache_grow(mem_cache_t* cache) {
+    if (cache->slabCount == cache->slabCapacity) {
+        size_t capacity = cache->slabCapacity ? cache->slabCapacity * 2 : 16;
+        void** slabs = realloc(cache->slabs, capacity * sizeof(void*));
+        if (!slabs) return false;
+        cache->slabs = slabs;
+        cache->slabCapacity = capacity;
     }
 
-    if (size == 0) {
-        mem_free(block);
+    for (size_t count = SLAB_MAX_OBJECTS; count > 0; count /= 2) {
+        size_t bytes = count * cache->objectSize;
+        void* slab = mm_alloc(cache->pool, bytes);
+        if (slab && (uintptr_t)slab % cache->align != 0) {
+            // Retry with room to align the first object
+            mm_free(cache->pool, slab);
+            slab = mm_alloc(cache->pool, bytes + cache->align - 1);
+        }
+        if (!slab) continue;
+
+        cache->slabs[cache->slabCount++] = slab;
+        void* object = (void*)(((uintptr_t)slab + cache->align - 1) &
+                               ~(uintptr_t)(cache->align - 1));
+        for (size_t i = 0; i < count; i++) {
+            memcpy(object, &cache->freeObjects, sizeof(void*));
+            cache->freeObjects = object;
+            object += cache->objectSize;
+        }
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Allocates an object from a cache.
+ *
+ * @param cache The cache to allocate from.
+ * @return A pointer to the object, or NULL if the pool is exhausted.
+ */
+void* mem_cache_alloc(mem_cache_t* cache) {
+    pthread_mutex_lock(&cache->lock);
+    if (cache->freeObjects == NULL && !mem_cache_grow(cache)) {
+        pthread_mutex_unlock(&cache->lock);
         return NULL;
     }
 
-    pthread_mutex_lock(&mLock);
+    void* object = cache->freeObjects;
+    memcpy(&cache->freeObjects, object, sizeof(void*));
+    pthread_mutex_unlock(&cache->lock);
+    return object;
+}
 
-    Node* walker = head;
-    Node* prev = NULL;
+/**
+ * Returns an object to the cache it was allocated from.
+ *
+ * @param cache The cache the object belongs to.
+ * @param object A pointer to the object to free.
+ */
+void mem_cache_free(mem_cache_t* cache, void* object) {
+    if (!object) return;
 
-    while (walker != NULL && walker->start != block) {
-        prev = walker;
-        walker = walker->next;
+    pthread_mutex_lock(&cache->lock);
+    memcpy(object, &cache->freeObjects, sizeof(void*));
+    cache->freeObjects = object;
+    pthread_mutex_unlock(&cache->lock);
+}
+
+/**
+ * Destroys a cache and returns all of its slabs to the pool. Objects still in
+ * use become invalid. Must be called before its pool is released.
+ *
+ * @param cache The cache to destroy.
+ */
+void mem_cache_destroy(mem_cache_t* cache) {
+    if (!cache) return;
+
+    for (size_t i = 0; i < cache->slabCount; i++) {
+        mm_free(cache->pool, cache->slabs[i]);
     }
+    free(cache->slabs);
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+}
 
-    if (walker == NULL) {
-        // Block not found
-        pthread_mutex_unlock(&mLock);
-        return NULL;
+/**
+ * Begins a region of a pool. A region hands out blocks by bumping a position
+ * through chunks taken from the pool, so an allocation is a comparison and an
+ * addition. Its blocks are not freed one by one: mem_region_reset frees every
+ * block allocated since a mark at once, and mem_region_end returns the chunks
+ * to the pool. A region has no lock, so only one thread may use it at a time.
+ *
+ * @param pool The pool to take chunks from.
+ * @param chunkSize The size of the chunks to take, 0 for REGION_CHUNK_SIZE.
+ * Larger requests get a chunk of their own size.
+ * @return A pointer to the new region, or NULL if it could not be created.
+ */
+mem_region_t* mm_region_begin(mm_pool_t* pool, size_t chunkSize) {
+    mem_region_t* region = calloc(1, sizeof(mem_region_t));
+    if (!region) return NULL;
+
+    region->pool = pool;
+    region->chunkSize = chunkSize ? chunkSize : REGION_CHUNK_SIZE;
+    region->align = _Alignof(max_align_t) > pool->align ? _Alignof(max_align_t)
+                                                         : pool->align;
+    return region;
+}
+
+/**
+ * Begins a region that takes its chunks from the default pool.
+ *
+ * @param chunkSize The size of the chunks to take, 0 for REGION_CHUNK_SIZE.
+ * @return A pointer to the new region, or NULL if it could not be created.
+ */
+mem_region_t* mem_region_begin(size_t chunkSize) {
+    return mm_region_begin(&defaultPool, chunkSize);
+}
+
+/**
+ * Moves a region to the chunk after its current one, so a request of the
+ * given size fits at its start. A chunk kept from before a reset is reused if
+ * it is large enough, and replaced otherwise. New chunks are as large as the
+ * region asks for, or smaller down to the request if the pool cannot supply
+ * that much.
+ *
+ * @param region The region.
+ * @param size The size of the request, a multiple of the region alignment.
+ * @return true if the region moved, false if no chunk could be taken.
+ */
+static bool region_next_chunk(mem_region_t* region, size_t size) {
+    // An unused chunk too small for the request is replaced in place
+    size_t next = region->offset > 0 ? region->current + 1 : region->current;
+    if (next < region->chunkCount && region->chunks[next].size >= size) {
+        region->current = next;
+        region->offset = 0;
+        return true;
     }
 
-    size_t oldSize = walker->end - walker->start;
+    if (next == region->chunkCount &&
+        region->chunkCount == region->chunkCapacity) {
+        size_t capacity =
+            region->chunkCapacity ? region->chunkCapacity * 2 : 16;
+        RegionChunk* chunks =
+            realloc(region->chunks, capacity * sizeof(RegionChunk));
+        if (!chunks) return false;
+        region->chunks = chunks;
+        region->chunkCapacity = capacity;
+    }
+
+    size_t chunkSize = region->chunkSize > size ? region->chunkSize : size;
+    void* base = mm_alloc_aligned(region->pool, chunkSize, region->align);
+    while (base == NULL && chunkSize > size) {
+        chunkSize = chunkSize / 2 > size
+                        ? chunkSize / 2 / region->align * region->align
+                        : size;
+        base = mm_alloc_aligned(region->pool, chunkSize, region->align);
+    }
+    if (base == NULL) return false;
 
-    // Remove the old block from the list
-    if (prev == NULL) {
-        head = walker->next;
+    if (next < region->chunkCount) {
+        mm_free(region->pool, region->chunks[next].base);
     } else {
-        prev->next = walker->next;
+        region->chunkCount++;
     }
+    region->chunks[next] = (RegionChunk){base, chunkSize};
+    region->current = next;
+    region->offset = 0;
+    return true;
+}
 
-    // Allocate a new block with the new size
-    void* newBlock = mem_alloc_no_lock(size);
-    if (newBlock) {
-        memcpy(newBlock, block, (size < oldSize) ? size : oldSize);
-        free(walker);
+/**
+ * Allocates a block from a region. The block starts at a multiple of the
+ * largest fundamental alignment, or of the pool's minimum alignment if that
+ * is larger.
+ *
+ * @param region The region to allocate from.
+ * @param size The size of the memory block to allocate.
+ * @return A pointer to the block, or NULL if size is 0 or the pool cannot
+ * supply a chunk for it.
+ */
+void* mem_region_alloc(mem_region_t* region, size_t size) {
+    if (size == 0 || size > SIZE_MAX - region->align) return NULL;
+    size = (size + region->align - 1) & ~(region->align - 1);
 
-        pthread_mutex_unlock(&mLock);
-        return newBlock;
-    } else {
-        // Allocation failed, restore the old block
-        if (prev == NULL) {
-            head = walker;
-        } else {
-            prev->next = walker;
+    if (region->current >= region->chunkCount ||
+        region->chunks[region->current].size - region->offset < size) {
+        if (!region_next_chunk(region, size)) return NULL;
+    }
+    void* block = region->chunks[region->current].base + region->offset;
+    region->offset += size;
+    return block;
+}
+
+/**
+ * Returns the current position of a region, to reset it to later.
+ *
+ * @param region The region.
+ * @return The mark.
+ */
+mem_region_mark_t mem_region_mark(mem_region_t* region) {
+    return (mem_region_mark_t){region->current, region->offset};
+}
+
+/**
+ * Frees every block allocated from a region since a mark, in constant time.
+ * The chunks taken since the mark are kept and reused by later allocations.
+ *
+ * @param region The region.
+ * @param mark A mark of the region taken no later than its current position
+ * and not discarded by an earlier reset, or a zeroed mark to free every
+ * block of the region.
+ */
+void mem_region_reset(mem_region_t* region, mem_region_mark_t mark) {
+    region->current = mark.chunk;
+    region->offset = mark.offset;
+}
+
+/**
+ * Ends a region, returning all of its chunks to the pool. Blocks of the
+ * region become invalid. Must be called before its pool is released or reset.
+ *
+ * @param region The region to end.
+ */
+void mem_region_end(mem_region_t* region) {
+    if (!region) return;
+
+    for (size_t i = 0; i < region->chunkCount; i++) {
+        mm_free(region->pool, region->chunks[i].base);
+    }
+    free(region->chunks);
+    free(region);
+}
+
+/**
+ * Allocates a relocatable block from a pool. The block may be moved by
+ * compaction while it is not locked, so it must only be accessed through the
+ * pointer returned by mem_hlock, until the matching mem_hunlock.
+ *
+ * @param pool The pool.
+ * @param size The size of the memory block to allocate.
+ * @return A handle to the block, or NULL if the allocation fails.
+ */
+mem_handle_t* mm_halloc(mm_pool_t* pool, size_t size) {
+    if (size == 0) return NULL;
+    if (size > pool->memorySize && size > pool->poolCeiling) return NULL;
+    size = (size + pool->align - 1) & ~(pool->align - 1);
+
+    void* block = arena_alloc(pool, size, 0, false);
+    if (block == NULL && flush_thread_caches(pool)) {
+        block = arena_alloc(pool, size, 0, false);
+    }
+    if (block == NULL && pool_fragmented(pool, size) &&
+        mm_compact(pool) > 0) {
+        block = arena_alloc(pool, size, 0, false);
+    }
+    if (block == NULL) block = pool_grow(pool, size, 0, false);
+    if (block == NULL) return NULL;
+
+    pthread_mutex_lock(&pool->handleLock);
+    if (pool->freeHandles == NULL) {
+        HandleChunk* chunk = malloc(sizeof(HandleChunk));
+        if (!chunk) {
+            pthread_mutex_unlock(&pool->handleLock);
+            arena_free(pool, block);
+            return NULL;
+        }
+        chunk->next = pool->handleChunks;
+        pool->handleChunks = chunk;
+        for (int i = HANDLE_CHUNK_SIZE - 1; i >= 0; i--) {
+            chunk->handles[i].block = NULL;
+            chunk->handles[i].nextFree = pool->freeHandles;
+            pool->freeHandles = &chunk->handles[i];
         }
+    }
+    mem_handle_t* handle = pool->freeHandles;
+    pool->freeHandles = handle->nextFree;
+    handle->pool = pool;
+    handle->block = block;
+    atomic_init(&handle->locks, 0);
+    pool->handleCount++;
+    pthread_mutex_unlock(&pool->handleLock);
+    return handle;
+}
 
-        pthread_mutex_unlock(&mLock);
-        return NULL;
+/**
+ * Allocates a relocatable block from the default pool.
+ *
+ * @param size The size of the memory block to allocate.
+ * @return A handle to the block, or NULL if the allocation fails.
+ */
+mem_handle_t* mem_halloc(size_t size) {
+    return mm_halloc(&defaultPool, size);
+}
+
+/**
+ * Pins a relocatable block so compaction leaves it in place. Locks nest; the
+ * block may move again once every lock has been released.
+ *
+ * @param handle The handle of the block.
+ * @return A pointer to the block, valid until the matching mem_hunlock.
+ */
+void* mem_hlock(mem_handle_t* handle) {
+    if (!handle) return NULL;
+
+    int locks = atomic_load_explicit(&handle->locks, memory_order_relaxed);
+    for (;;) {
+        if (locks == HANDLE_MOVING) {
+            sched_yield();
+            locks = atomic_load_explicit(&handle->locks, memory_order_relaxed);
+        } else if (atomic_compare_exchange_weak_explicit(
+                       &handle->locks, &locks, locks + 1,
+                       memory_order_acquire, memory_order_relaxed)) {
+            return handle->block;
+        }
     }
 }
 
 /**
- * Deinitializes the memory manager by freeing all allocated memory blocks and
- * resetting the memory manager state.
+ * Releases a lock taken with mem_hlock.
+ *
+ * @param handle The handle of the block.
  */
-void mem_deinit() {
-    Node* curr = head;
-    while (curr != NULL) {
-        Node* next = curr->next;
-        free(curr);
-        curr = next;
-    }
-    free(memoryPool);
-    memoryPool = NULL;
-    memorySize = 0;
-    head = NULL;
-    pthread_mutex_destroy(&mLock);
-}
\ No newline at end of file
+void mem_hunlock(mem_handle_t* handle) {
+    if (!handle) return;
+    atomic_fetch_sub_explicit(&handle->locks, 1, memory_order_release);
+}
+
+/**
+ * Frees a relocatable block and its handle. The block must not be locked.
+ *
+ * @param handle The handle of the block to free.
+ */
+void mem_hfree(mem_handle_t* handle) {
+    if (!handle) return;
+
+    mm_pool_t* pool = handle->pool;
+    pthread_mutex_lock(&pool->handleLock);
+    void* block = handle->block;
+    handle->block = NULL;
+    handle->nextFree = pool->freeHandles;
+    pool->freeHandles = handle;
+    pool->handleCount--;
+    pthread_mutex_unlock(&pool->handleLock);
+    arena_free(pool, block);
+}
+
+/**
+ * Compacts a pool by sliding unlocked handle blocks together, so the free
+ * space between them becomes one gap at the top of each arena. Plain blocks
+ * and locked handle blocks stay in place. Thread caches are flushed and runs
+ * dissolved first, so their free space joins the gaps. Called automatically
+ * when an allocation fails while handles are in use and some arena has enough
+ * free bytes scattered over its gaps.
+ *
+ * Only the list engine keeps the address-ordered records compaction needs;
+ * with the other engines nothing is moved.
+ *
+ * @param pool The pool.
+ * @return The number of bytes moved.
+ */
+size_t mm_compact(mm_pool_t* pool) {
+    if (pool->engine != &listEngine) return 0;
+
+    pthread_mutex_lock(&pool->handleLock);
+    mem_handle_t** handles = NULL;
+    if (pool->handleCount > 0) {
+        handles = malloc(pool->handleCount * sizeof(mem_handle_t*));
+    }
+    if (handles == NULL) {
+        pthread_mutex_unlock(&pool->handleLock);
+        return 0;
+    }
+    flush_thread_caches(pool);
+
+    size_t count = 0;
+    for (HandleChunk* chunk = pool->handleChunks; chunk != NULL;
+         chunk = chunk->next) {
+        for (int i = 0; i < HANDLE_CHUNK_SIZE; i++) {
+            if (chunk->handles[i].block != NULL) {
+                handles[count++] = &chunk->handles[i];
+            }
+        }
+    }
+    qsort(handles, count, sizeof(mem_handle_t*), compare_handle);
+
+    size_t moved = 0;
+    for (size_t i = 0; i < arena_total(pool); i++) {
+        Arena* a = arena_at(pool, i);
+        arena_lock(a);
+        if (bump_absorb(a)) {
+            tiny_flush(a);
+            flush_size_classes(a);
+            moved += list_compact(a, handles, count);
+        }
+        pthread_mutex_unlock(&a->lock);
+    }
+    pthread_mutex_unlock(&pool->handleLock);
+    free(handles);
+    return moved;
+}
+
+/**
+ * Compacts the default pool.
+ *
+ * @return The number of bytes moved.
+ */
+size_t mem_compact() {
+    return mm_compact(&defaultPool);
+}
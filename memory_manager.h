@@ -7,10 +7,99 @@
 #include <stdbool.h>
 #include <pthread.h>
 
+typedef enum {
+    MEM_ENGINE_LIST,  // Address-ordered block list, placement by policy
+    MEM_ENGINE_TLSF,  // Two-level segregated fit, O(1) alloc and free
+    MEM_ENGINE_BUDDY,  // Binary buddy system, O(log n) split and merge
+} mem_engine_t;
+
+typedef enum {
+    MEM_POLICY_FIRST_FIT,  // Lowest gap that fits
+    MEM_POLICY_NEXT_FIT,   // First gap that fits after the last block placed
+    MEM_POLICY_BEST_FIT,   // Smallest gap that fits
+    MEM_POLICY_WORST_FIT,  // Largest gap
+} mem_policy_t;
+
+typedef enum {
+    MEM_PAGES_DEFAULT,  // Reserved pool, committed as it is used
+    MEM_PAGES_HUGE,     // mmap aligned to 2 MiB, transparent huge pages
+    MEM_PAGES_HUGETLB,  // Reserved huge pages, or MEM_PAGES_HUGE without them
+} mem_pages_t;
+
+typedef struct {
+    mem_engine_t engine;
+    size_t arenas;  // Independently locked slices of the pool, 0 means 1
+    mem_pages_t pages;
+    size_t trimThreshold;  // Bytes freed in an arena to trim it after, 0 never
+    size_t maxSize;  // Size the pool may grow to by adding chunks, 0 no growth
+    size_t align;  // Minimum alignment of every block, up to a page, 0 means 1
+    // Per-CPU locked caches in place of thread caches. Without registered
+    // restartable sequences the pool has no caches and frees take the lock.
+    bool cpuCaches;
+    bool numa;  // One arena per NUMA node, in place of arenas
+    bool engineOnly;  // Skip tails, tiny runs and caches, to measure the engine
+} mem_config_t;
+
+typedef struct mm_pool mm_pool_t;
+typedef struct mem_cache mem_cache_t;
+typedef struct mem_handle mem_handle_t;
+typedef struct mem_region mem_region_t;
+
+// A position in a region to reset it to. A zeroed mark is its start.
+typedef struct {
+    size_t chunk;
+    size_t offset;
+} mem_region_mark_t;
+
+// The mem_* functions work on a default pool set up by mem_init. The mm_*
+// functions work on pools of their own, each with separate locks and arenas.
+
 void mem_init(size_t size);
+void mem_init_config(size_t size, const mem_config_t* config);
+void mem_set_policy(mem_policy_t policy);
 void* mem_alloc(size_t size);
+void* mem_alloc_aligned(size_t size, size_t align);
+bool mem_alloc_batch(const size_t* sizes, size_t n, void** out);
 void mem_free(void* block);
+void mem_free_batch(void* const* blocks, size_t n);
 void* mem_resize(void* block, size_t size);
 void mem_deinit();
+void mem_reset();
+size_t mem_trim();
+
+mem_cache_t* mem_cache_create(size_t size, size_t align);
+void* mem_cache_alloc(mem_cache_t* cache);
+void mem_cache_free(mem_cache_t* cache, void* object);
+void mem_cache_destroy(mem_cache_t* cache);
+
+mem_region_t* mem_region_begin(size_t chunkSize);
+void* mem_region_alloc(mem_region_t* region, size_t size);
+mem_region_mark_t mem_region_mark(mem_region_t* region);
+void mem_region_reset(mem_region_t* region, mem_region_mark_t mark);
+void mem_region_end(mem_region_t* region);
+
+mem_handle_t* mem_halloc(size_t size);
+void* mem_hlock(mem_handle_t* handle);
+void mem_hunlock(mem_handle_t* handle);
+void mem_hfree(mem_handle_t* handle);
+size_t mem_compact();
+
+mm_pool_t* mm_create(size_t size);
+mm_pool_t* mm_create_config(size_t size, const mem_config_t* config);
+void mm_destroy(mm_pool_t* pool);
+void mm_set_policy(mm_pool_t* pool, mem_policy_t policy);
+void* mm_alloc(mm_pool_t* pool, size_t size);
+void* mm_alloc_aligned(mm_pool_t* pool, size_t size, size_t align);
+bool mm_alloc_batch(mm_pool_t* pool, const size_t* sizes, size_t n,
+                    void** out);
+void mm_free(mm_pool_t* pool, void* block);
+void mm_free_batch(mm_pool_t* pool, void* const* blocks, size_t n);
+void* mm_resize(mm_pool_t* pool, void* block, size_t size);
+void mm_reset(mm_pool_t* pool);
+size_t mm_trim(mm_pool_t* pool);
+mem_cache_t* mm_cache_create(mm_pool_t* pool, size_t size, size_t align);
+mem_region_t* mm_region_begin(mm_pool_t* pool, size_t chunkSize);
+mem_handle_t* mm_halloc(mm_pool_t* pool, size_t size);
+size_t mm_compact(mm_pool_t* pool);
 
-#endif
\ No newline at end of file
+#endif
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <pthread.h>
 #include <sys/time.h>
 #include <math.h>
@@ -14,6 +15,11 @@
 #include "common_defs.h"
 
 #include <unistd.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
 
 #define debug 0
 
@@ -33,6 +39,7 @@ typedef struct
     int max_block_size;    // Maximum size of a block
     void **block_pointers; // Array to hold pointers to allocated blocks
     bool simulate_work;    // Flag to simulate work in the thread, i.e. put the thread to sleep for a while
+    int batch_size;        // Blocks per mem_alloc_batch and mem_free_batch call, 0 for one call per block
 } thread_data_t;
 
 // Structure to hold test function parameters
@@ -44,6 +51,7 @@ typedef struct
     int num_blocks;
     size_t block_size;
     bool simulate_work;
+    int batch_size;
 } TestParams;
 
 // Function to calculate memory allocations for threads based on redistribution logic
@@ -300,6 +308,86 @@ void test_random_blocks_multithread(TestParams params)
     printf_green("[PASS].\n");
 }
 
+/*
+ * This function is used to test that mem_resize keeps blocks in place in a multithreading context.
+ * Every thread shrinks its buffer and grows it back again and again, while the space after each buffer is left free.
+ * A hole of the full buffer size at the front of the pool would let a moving resize relocate there.
+ * The test passes if no buffer ever moves and the data in front of each resize is kept.
+ */
+void *thread_resize_in_place(void *arg)
+{
+    thread_data_t *data = (thread_data_t *)arg;
+    size_t small_size = data->block_size / 8;
+    intptr_t failures = 0;
+
+    char *block = mem_alloc(data->block_size);
+    if (block != NULL)
+        memset(block, data->thread_id, data->block_size);
+
+    // Wait even on failure, so the other threads are not left at the barrier
+    my_barrier_wait(&barrier);
+    if (block == NULL)
+        return (void *)1;
+
+    for (int i = 0; i < data->iterations; i++)
+    {
+        if (mem_resize(block, small_size) != block)
+            failures++;
+        sanityCheck(small_size, block, data->thread_id);
+
+        if (mem_resize(block, data->block_size) != block)
+            failures++;
+        sanityCheck(small_size, block, data->thread_id);
+        memset(block, data->thread_id, data->block_size);
+    }
+
+    mem_free(block);
+    return (void *)failures;
+}
+
+void test_resize_in_place_multithread(TestParams params)
+{
+    printf_yellow("  Testing \"mem_resize in place\" (threads: %d, block_size: %zu, iterations: %d) ---> ", params.num_threads, params.block_size, params.iterations);
+
+    pthread_t threads[params.num_threads];
+    thread_data_t params_t[params.num_threads];
+
+    my_barrier_init(&barrier, params.num_threads + 1);
+    mem_init((params.num_threads + 1) * params.block_size);
+    void *hole = mem_alloc(params.block_size);
+
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        params_t[i].thread_id = i;
+        params_t[i].block_size = params.block_size;
+        params_t[i].iterations = params.iterations;
+        pthread_create(&threads[i], NULL, thread_resize_in_place, &params_t[i]);
+    }
+
+    my_barrier_wait(&barrier);
+    mem_free(hole);
+
+    int failures = 0;
+    void *status;
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        pthread_join(threads[i], &status);
+        failures += (long)status;
+    }
+
+    mem_deinit();
+    my_barrier_destroy(&barrier);
+
+    if (failures == 0)
+    {
+        printf_green("[PASS].\n");
+    }
+    else
+    {
+        printf_red("[FAIL]: Blocks were moved %d times.\n", failures);
+    }
+}
+
 /*
  * This function is used to test the resizing of memory blocks in a multithreading context.
  * Each thread will allocate a block of memory, resize it, and then free it.
@@ -675,193 +763,2447 @@ void test_repeated_fit_reuse_multithread(TestParams params)
     }
 }
 
-void *repeated_allocate_and_free(void *arg)
+/*
+ * This function is used to test the size-class front end in a multithreading context.
+ * Each thread churns small blocks of its own size, so a freed block should come straight back on the next allocation.
+ * Afterwards the whole pool must still be available in one piece, i.e. parked blocks are merged back on demand.
+ */
+void *thread_size_class_reuse(void *arg)
 {
     thread_data_t *data = (thread_data_t *)arg;
-    int cycles = data->iterations; // Use iterations from thread data for number of cycles
+    intptr_t misses = 0;
 
-    for (int i = 0; i < cycles; i++)
+    for (int i = 0; i < data->iterations; i++)
     {
-        void *block = mem_alloc(data->block_size); // Allocate using the block_size from thread data
+        void *block = mem_alloc(data->block_size);
         if (block == NULL)
-        {
-            if (debug)
-                printf_red("    Thread %d failed to allocate %zu bytes\n", data->thread_id, data->block_size);
-            continue; // Skip freeing and proceed to the next cycle
-        }
-        if (debug)
-            printf_yellow("    Thread %d allocated and will now free %zu bytes\n", data->thread_id, data->block_size);
-        my_barrier_wait(&barrier); // Synchronize after allocation
-
-        mem_free(block); // Free the block to create fragmentation
+            return (void *)1;
+        memset(block, data->thread_id, data->block_size);
+        mem_free(block);
 
-        my_barrier_wait(&barrier); // Synchronize after free
+        void *again = mem_alloc(data->block_size);
+        if (again != block)
+            misses++;
+        mem_free(again);
     }
 
-    return NULL;
+    return (void *)misses;
 }
 
-// Function for threads to attempt allocation in the fragmented memory
-void *repeated_allocate_in_fragment(void *arg)
+void test_size_class_reuse_multithread(TestParams params)
 {
-    thread_data_t *data = (thread_data_t *)arg;
-    int cycles = data->iterations; // Number of allocation attempts per thread
+    printf_yellow("  Testing \"size class reuse\" (threads: %d, mem_size: %zu, iterations: %d) ---> ", params.num_threads, params.memory_size, params.iterations);
 
-    for (int i = 0; i < cycles; i++)
+    pthread_t threads[params.num_threads];
+    thread_data_t params_t[params.num_threads];
+
+    mem_init(params.memory_size);
+
+    for (int i = 0; i < params.num_threads; i++)
     {
-        my_barrier_wait(&barrier); // Wait until fragmentation is created
+        params_t[i].thread_id = i;
+        params_t[i].block_size = 16 * (i + 1); // A distinct size class per thread
+        params_t[i].iterations = params.iterations;
+        pthread_create(&threads[i], NULL, thread_size_class_reuse, &params_t[i]);
+    }
 
-        // Attempt to allocate in the fragmented space
-        void *block = mem_alloc(data->block_size);
-        if (block != NULL)
-        {
-            if (debug)
-                printf_yellow("    Thread %d allocated %zu bytes in fragmented memory\n", data->thread_id, data->block_size);
-            mem_free(block);
-        }
-        else
+    int failures = 0;
+    void *status;
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        pthread_join(threads[i], &status);
+        if ((long)status != 0)
         {
-            if (debug)
-                printf_red("    Thread %d failed to allocate %zu bytes in fragmented memory\n", data->thread_id, data->block_size);
+            failures++;
         }
+    }
 
-        my_barrier_wait(&barrier); // Synchronize before the next cycle
+    // Parked blocks must not stop the pool from being used as a single block
+    void *whole = mem_alloc(params.memory_size);
+    my_assert(whole != NULL);
+    mem_free(whole);
+
+    mem_deinit();
+
+    if (failures == 0 && whole != NULL)
+    {
+        printf_green("[PASS].\n");
+    }
+    else
+    {
+        printf_red("[FAIL]: Small blocks were not recycled from their size class.\n");
     }
+}
 
-    return NULL;
+/*
+ * This function is used to test freeing blocks out of allocation order in a multithreading context.
+ * Each thread allocates its blocks and frees them back to front with every other block skipped, then frees the rest.
+ * The test passes if the whole pool can be allocated as a single block afterwards.
+ */
+void *thread_free_out_of_order(void *arg)
+{
+    thread_data_t *data = (thread_data_t *)arg;
+
+    for (int i = 0; i < data->num_blocks; i++)
+    {
+        data->block_pointers[i] = mem_alloc(data->block_size);
+        if (data->block_pointers[i] == NULL)
+            return (void *)1;
+    }
+
+    for (int i = data->num_blocks - 1; i >= 0; i -= 2)
+        mem_free(data->block_pointers[i]);
+    for (int i = data->num_blocks - 2; i >= 0; i -= 2)
+        mem_free(data->block_pointers[i]);
+
+    return (void *)0;
 }
 
-void test_memory_fragmentation_multithread(TestParams params)
+void test_free_out_of_order_multithread(TestParams params)
 {
-    printf_yellow("  Testing \"memory fragmentation handling\" (threads: %d, mem_size: %zu, iterations: %d) ---> ", params.num_threads, params.memory_size, params.iterations);
-    mem_init(params.memory_size); // Initialize with specified memory size to accommodate load
+    printf_yellow("  Testing \"mem_free out of order\" (threads: %d, blocks: %d, block_size: %zu) ---> ", params.num_threads, params.num_blocks, params.block_size);
 
     pthread_t threads[params.num_threads];
-    thread_data_t params_t[params.num_threads]; // Array of thread data
-
-    my_barrier_init(&barrier, params.num_threads); // Initialize the barrier
+    thread_data_t params_t[params.num_threads];
+    void *block_pointers[params.num_blocks];
+    size_t mem_size = params.num_blocks * params.block_size;
+    int blocks_per_thread = params.num_blocks / params.num_threads;
 
-    // Dynamically calculate block size based on available memory and the number of threads
-    size_t base_block_size = params.memory_size / (params.num_threads * 3); // Adjust factor if necessary to prevent over-allocation
+    mem_init(mem_size);
 
-    // Setup thread parameters
     for (int i = 0; i < params.num_threads; i++)
     {
         params_t[i].thread_id = i;
-        params_t[i].block_size = base_block_size * (i % 3 + 1); // Multiplicative factor to vary block size: 1x, 2x, 3x
-        params_t[i].iterations = params.iterations;             // Set the number of allocation-free cycles
+        params_t[i].block_size = params.block_size;
+        params_t[i].num_blocks = blocks_per_thread;
+        params_t[i].block_pointers = &block_pointers[i * blocks_per_thread];
+        pthread_create(&threads[i], NULL, thread_free_out_of_order, &params_t[i]);
+    }
 
-        if (i % 2 == 0)
-        {
-            // Even-indexed threads create fragmentation
-            pthread_create(&threads[i], NULL, repeated_allocate_and_free, &params_t[i]);
-        }
-        else
+    int failures = 0;
+    void *status;
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        pthread_join(threads[i], &status);
+        if ((long)status != 0)
         {
-            // Odd-indexed threads attempt to fill fragmented spaces
-            pthread_create(&threads[i], NULL, repeated_allocate_in_fragment, &params_t[i]);
+            failures++;
         }
     }
 
-    // Wait for all threads to finish
-    for (int i = 0; i < params.num_threads; i++)
+    void *whole = mem_alloc(mem_size);
+    my_assert(whole != NULL);
+    mem_free(whole);
+
+    mem_deinit();
+
+    if (failures == 0 && whole != NULL)
     {
-        pthread_join(threads[i], NULL);
+        printf_green("[PASS].\n");
+    }
+    else
+    {
+        printf_red("[FAIL]: Some blocks were not released.\n");
     }
-
-    mem_deinit(); // Clean up the memory manager
-    my_barrier_destroy(&barrier);
-    printf_green("[PASS].\n");
 }
 
-void *thread_function(void *arg)
+/*
+ * This function is used to test the buddy engine with power-of-two blocks in a multithreading context.
+ * The threads fill the pool exactly with blocks of a single power-of-two size and check their data after a barrier.
+ * The test passes if every allocation succeeds and the pool merges back into one block once everything is freed.
+ */
+void *thread_buddy_blocks(void *arg)
 {
-    thread_data_t *params = (thread_data_t *)arg;
-    int thread_id = params->thread_id;
-    int num_allocations = params->num_blocks;
-    size_t block_size = params->block_size;
-
-    char **blocks = (char **)malloc(num_allocations * sizeof(char *));
-    my_assert(blocks != NULL); // Check that allocation was successful
+    thread_data_t *data = (thread_data_t *)arg;
+    char *blocks[4];
 
-    for (int i = 0; i < num_allocations; i++)
+    for (int i = 0; i < 4; i++)
     {
-        // Allocate memory
-        blocks[i] = (char *)mem_alloc(block_size);
-        my_assert(blocks[i] != NULL); // Check allocation was successful
-        // printf("Thread %d: Allocated block %d at %p = %d\n", thread_id, i, blocks[i], thread_id * num_allocations + i);
-        // Write a unique pattern based on thread_id and index i
-        memset(blocks[i], thread_id * num_allocations + i, block_size);
-
-        // Optionally, simulate some work or delay
-        if (params->simulate_work)
-            usleep(rand() % 1000);
+        blocks[i] = mem_alloc(data->block_size);
+        if (blocks[i] == NULL)
+            return (void *)1;
+        memset(blocks[i], data->thread_id * 4 + i, data->block_size);
     }
 
-    // my_barrier_wait(&barrier);
+    my_barrier_wait(&barrier);
 
-    for (int i = 0; i < num_allocations; i++)
+    for (int i = 0; i < 4; i++)
     {
-        sanityCheck(block_size, blocks[i], (char)(thread_id * num_allocations + i));
-
-        // Free memory
+        sanityCheck(data->block_size, blocks[i], (char)(data->thread_id * 4 + i));
         mem_free(blocks[i]);
     }
-    // Free the dynamically allocated array of pointers
-    free(blocks);
 
-    return NULL;
+    return (void *)0;
 }
 
-void run_concurrency_test(TestParams params)
+void test_buddy_power_of_two_multithread(TestParams params)
 {
-    printf_yellow("  Running concurrency test with %d threads, %d allocations per thread, and block size %zu bytes --> ", params.num_threads, params.num_blocks / params.num_threads, params.block_size);
-    struct timeval start_time, end_time;
-    gettimeofday(&start_time, NULL); // Start timing
+    printf_yellow("  Testing \"buddy engine\" (threads: %d, mem_size: %zu) ---> ", params.num_threads, params.memory_size);
+
     pthread_t threads[params.num_threads];
     thread_data_t params_t[params.num_threads];
+
     my_barrier_init(&barrier, params.num_threads);
-    // Initialize your memory manager here
-    mem_init(params.num_blocks * params.block_size); // Initialize with enough memory for the test
+    mem_init_config(params.memory_size, &(mem_config_t){.engine = MEM_ENGINE_BUDDY});
 
-    // Create multiple threads to perform memory operations
     for (int i = 0; i < params.num_threads; i++)
     {
         params_t[i].thread_id = i;
-        params_t[i].num_blocks = params.num_blocks / params.num_threads;
-        params_t[i].block_size = params.block_size;
-        params_t[i].simulate_work = params.simulate_work;
-        pthread_create(&threads[i], NULL, thread_function, &params_t[i]);
+        params_t[i].block_size = params.memory_size / (params.num_threads * 4);
+        pthread_create(&threads[i], NULL, thread_buddy_blocks, &params_t[i]);
     }
 
-    // Join all threads
+    int failures = 0;
+    void *status;
     for (int i = 0; i < params.num_threads; i++)
     {
-        pthread_join(threads[i], NULL);
+        pthread_join(threads[i], &status);
+        if ((long)status != 0)
+        {
+            failures++;
+        }
     }
 
-    // Clean up the memory manager here if needed
-    mem_deinit();
+    // Every buddy pair must have merged again
+    void *whole = mem_alloc(params.memory_size);
+    my_assert(whole != NULL);
+    mem_free(whole);
 
-    gettimeofday(&end_time, NULL); // End timing
-    my_barrier_destroy(&barrier);  // Destroy the barrier
-    // Calculate elapsed time
-    long seconds = end_time.tv_sec - start_time.tv_sec;
-    long micros = ((seconds * 1000000) + end_time.tv_usec) - (start_time.tv_usec);
-    printf_yellow("Time: %ld microseconds.\t", micros);
+    mem_deinit();
+    my_barrier_destroy(&barrier);
 
-    printf_green("[PASS].\n");
+    if (failures == 0 && whole != NULL)
+    {
+        printf_green("[PASS].\n");
+    }
+    else
+    {
+        printf_red("[FAIL]: The pool could not be filled with buddy blocks or did not merge back.\n");
+    }
 }
 
-/* repeated from A1, as there were solutions that has issues */
+/*
+ * This function is used to test the object cache API in a multithreading context.
+ * The threads share one cache and fill a pool sized for exactly num_blocks objects, twice, freeing everything in between.
+ * The test passes if every object can be allocated in both rounds and the pool is whole again once the cache is destroyed.
+ */
+typedef struct
+{
+    int thread_id;
+    int num_objects;
+    mem_cache_t *cache;
+} cache_thread_data_t;
 
-void test_looking_for_out_of_bounds()
+void *thread_cache_objects(void *arg)
 {
-    printf("  Testing outofbounds (errors not tracked/detected here) \n");
+    cache_thread_data_t *data = (cache_thread_data_t *)arg;
+    char **objects = malloc(data->num_objects * sizeof(char *));
+    intptr_t failures = 0;
 
-    printf("ALLOCATION 5000\n");
-    mem_init(5000); // Initialize with 1024 bytes
-    printf("ALLOCATED 5000\n");
+    for (int round = 0; round < 2; round++)
+    {
+        for (int i = 0; i < data->num_objects; i++)
+        {
+            objects[i] = mem_cache_alloc(data->cache);
+            if (objects[i] == NULL)
+            {
+                failures++;
+                continue;
+            }
+            my_assert((uintptr_t)objects[i] % 8 == 0);
+            memset(objects[i], data->thread_id, 32);
+        }
+
+        my_barrier_wait(&barrier);
+
+        for (int i = 0; i < data->num_objects; i++)
+        {
+            sanityCheck(32, objects[i], data->thread_id);
+            mem_cache_free(data->cache, objects[i]);
+        }
+
+        my_barrier_wait(&barrier);
+    }
+
+    free(objects);
+    return (void *)failures;
+}
+
+void test_object_cache_multithread(TestParams params)
+{
+    printf_yellow("  Testing \"mem_cache\" (threads: %d, objects: %d) ---> ", params.num_threads, params.num_blocks);
+
+    pthread_t threads[params.num_threads];
+    cache_thread_data_t params_t[params.num_threads];
+    size_t mem_size = params.num_blocks * 32;
+
+    my_barrier_init(&barrier, params.num_threads);
+    mem_init(mem_size);
+    mem_cache_t *cache = mem_cache_create(32, 8);
+
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        params_t[i].thread_id = i;
+        params_t[i].num_objects = params.num_blocks / params.num_threads;
+        params_t[i].cache = cache;
+        pthread_create(&threads[i], NULL, thread_cache_objects, &params_t[i]);
+    }
+
+    int failures = 0;
+    void *status;
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        pthread_join(threads[i], &status);
+        failures += (long)status;
+    }
+
+    mem_cache_destroy(cache);
+    void *whole = mem_alloc(mem_size);
+    my_assert(whole != NULL);
+    mem_free(whole);
+
+    mem_deinit();
+    my_barrier_destroy(&barrier);
+
+    if (failures == 0 && whole != NULL)
+    {
+        printf_green("[PASS].\n");
+    }
+    else
+    {
+        printf_red("[FAIL]: %d object allocations failed.\n", failures);
+    }
+}
+
+/*
+ * This function is used to test the per-thread caches of freed blocks in a multithreading context.
+ * Every thread fills its share of the pool with small blocks and frees them into its own cache. One thread then
+ * allocates the whole pool, which only works if the other threads' caches are flushed on demand. Finally every thread
+ * caches its blocks again and exits.
+ * The test passes if the whole pool can be allocated once all threads have exited, i.e. exiting returns cached blocks.
+ */
+void *thread_cache_flush(void *arg)
+{
+    thread_data_t *data = (thread_data_t *)arg;
+    intptr_t failures = 0;
+
+    for (int round = 0; round < 2; round++)
+    {
+        for (int i = 0; i < data->num_blocks; i++)
+        {
+            data->block_pointers[i] = mem_alloc(data->block_size);
+            if (data->block_pointers[i] == NULL)
+                failures++;
+        }
+        for (int i = 0; i < data->num_blocks; i++)
+            mem_free(data->block_pointers[i]);
+
+        my_barrier_wait(&barrier);
+
+        if (round == 0 && data->thread_id == 0)
+        {
+            void *whole = mem_alloc(data->max_block_size);
+            if (whole == NULL)
+                failures++;
+            mem_free(whole);
+        }
+
+        my_barrier_wait(&barrier);
+    }
+
+    return (void *)failures;
+}
+
+void test_thread_cache_flush_multithread(TestParams params)
+{
+    printf_yellow("  Testing \"thread cache flush\" (threads: %d, blocks: %d, block_size: %zu) ---> ", params.num_threads, params.num_blocks, params.block_size);
+
+    pthread_t threads[params.num_threads];
+    thread_data_t params_t[params.num_threads];
+    size_t mem_size = params.num_threads * params.num_blocks * params.block_size;
+
+    my_barrier_init(&barrier, params.num_threads);
+    mem_init(mem_size);
+
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        params_t[i].thread_id = i;
+        params_t[i].num_blocks = params.num_blocks;
+        params_t[i].block_size = params.block_size;
+        params_t[i].max_block_size = mem_size;
+        params_t[i].block_pointers = malloc(params.num_blocks * sizeof(void *));
+        pthread_create(&threads[i], NULL, thread_cache_flush, &params_t[i]);
+    }
+
+    int failures = 0;
+    void *status;
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        pthread_join(threads[i], &status);
+        failures += (long)status;
+        free(params_t[i].block_pointers);
+    }
+
+    void *whole = mem_alloc(mem_size);
+    my_assert(whole != NULL);
+    mem_free(whole);
+
+    mem_deinit();
+    my_barrier_destroy(&barrier);
+
+    if (failures == 0 && whole != NULL)
+    {
+        printf_green("[PASS].\n");
+    }
+    else
+    {
+        printf_red("[FAIL]: Cached blocks were not returned to the pool.\n");
+    }
+}
+
+/*
+ * This function is used to test a pool split into several arenas in a multithreading context.
+ * Every thread allocates blocks in its own arena, and after a barrier frees the blocks of the next thread, so frees have
+ * to be routed to the arena owning each block.
+ * The test passes if all allocations succeed and every arena can be allocated as a single block afterwards.
+ */
+typedef struct
+{
+    thread_data_t *self;
+    thread_data_t *next; // The thread whose blocks this thread frees
+} arena_thread_data_t;
+
+void *thread_arena_blocks(void *arg)
+{
+    thread_data_t *data = ((arena_thread_data_t *)arg)->self;
+    thread_data_t *next = ((arena_thread_data_t *)arg)->next;
+    intptr_t failures = 0;
+
+    for (int i = 0; i < data->num_blocks; i++)
+    {
+        data->block_pointers[i] = mem_alloc(data->block_size);
+        if (data->block_pointers[i] == NULL)
+        {
+            failures++;
+            continue;
+        }
+        memset(data->block_pointers[i], data->thread_id, data->block_size);
+    }
+
+    my_barrier_wait(&barrier);
+
+    for (int i = 0; i < next->num_blocks; i++)
+    {
+        if (next->block_pointers[i] == NULL)
+            continue;
+        sanityCheck(next->block_size, next->block_pointers[i], next->thread_id);
+        mem_free(next->block_pointers[i]);
+    }
+
+    return (void *)failures;
+}
+
+void test_arenas_multithread(TestParams params, mem_engine_t engine, const char *engine_name)
+{
+    printf_yellow("  Testing \"arenas\" (engine: %s, threads: %d, arenas: %d) ---> ", engine_name, params.num_threads, params.num_blocks);
+
+    pthread_t threads[params.num_threads];
+    thread_data_t params_t[params.num_threads];
+    arena_thread_data_t args[params.num_threads];
+    size_t arena_size = params.memory_size / params.num_blocks;
+
+    my_barrier_init(&barrier, params.num_threads);
+    mem_init_config(params.memory_size, &(mem_config_t){.engine = engine, .arenas = params.num_blocks});
+
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        params_t[i].thread_id = i;
+        params_t[i].block_size = 64;
+        params_t[i].num_blocks = params.memory_size / params.num_threads / 64 / 2;
+        params_t[i].block_pointers = malloc(params_t[i].num_blocks * sizeof(void *));
+        args[i].self = &params_t[i];
+        args[i].next = &params_t[(i + 1) % params.num_threads];
+    }
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        pthread_create(&threads[i], NULL, thread_arena_blocks, &args[i]);
+    }
+
+    int failures = 0;
+    void *status;
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        pthread_join(threads[i], &status);
+        failures += (long)status;
+    }
+    for (int i = 0; i < params.num_threads; i++)
+        free(params_t[i].block_pointers);
+
+    // Every arena must be whole again, one arena-sized block each
+    void *blocks[params.num_blocks];
+    int whole = 0;
+    for (int i = 0; i < params.num_blocks; i++)
+    {
+        blocks[i] = mem_alloc(arena_size);
+        if (blocks[i] != NULL)
+            whole++;
+    }
+    for (int i = 0; i < params.num_blocks; i++)
+        mem_free(blocks[i]);
+
+    mem_deinit();
+    my_barrier_destroy(&barrier);
+
+    if (failures == 0 && whole == params.num_blocks)
+    {
+        printf_green("[PASS].\n");
+    }
+    else
+    {
+        printf_red("[FAIL]: %d allocations failed, %d of %d arenas were whole.\n", failures, whole, params.num_blocks);
+    }
+}
+
+/*
+ * This function checks that a pool with a ceiling grows by chunks instead of failing. The threads allocate four times
+ * the initial pool and free each other's blocks, a block twice the size of the pool is served by a chunk of its own,
+ * and a block beyond the ceiling still fails.
+ */
+void test_pool_growth_multithread(TestParams params, mem_engine_t engine, const char *engine_name)
+{
+    printf_yellow("  Testing \"pool growth\" (engine: %s, threads: %d, memory_size: %zu) ---> ", engine_name, params.num_threads, params.memory_size);
+
+    pthread_t threads[params.num_threads];
+    thread_data_t params_t[params.num_threads];
+    arena_thread_data_t args[params.num_threads];
+    size_t max_size = 8 * params.memory_size;
+
+    my_barrier_init(&barrier, params.num_threads);
+    mem_init_config(params.memory_size, &(mem_config_t){.engine = engine, .maxSize = max_size});
+
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        params_t[i].thread_id = i;
+        params_t[i].block_size = params.block_size;
+        params_t[i].num_blocks = 4 * params.memory_size / params.num_threads / params.block_size;
+        params_t[i].block_pointers = malloc(params_t[i].num_blocks * sizeof(void *));
+        args[i].self = &params_t[i];
+        args[i].next = &params_t[(i + 1) % params.num_threads];
+    }
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        pthread_create(&threads[i], NULL, thread_arena_blocks, &args[i]);
+    }
+
+    int failures = 0;
+    void *status;
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        pthread_join(threads[i], &status);
+        failures += (long)status;
+    }
+    for (int i = 0; i < params.num_threads; i++)
+        free(params_t[i].block_pointers);
+
+    char *large = mem_alloc(2 * params.memory_size);
+    if (large != NULL)
+    {
+        memset(large, 0x5a, 2 * params.memory_size);
+        sanityCheck(2 * params.memory_size, large, 0x5a);
+    }
+    void *beyond = mem_alloc(max_size + 1);
+    mem_free(large);
+    mem_free(beyond);
+
+    mem_deinit();
+    my_barrier_destroy(&barrier);
+
+    if (failures == 0 && large != NULL && beyond == NULL)
+    {
+        printf_green("[PASS].\n");
+    }
+    else
+    {
+        printf_red("[FAIL]: %d allocations failed%s%s.\n", failures, large == NULL ? ", pool did not grow for a large block" : "", beyond != NULL ? ", pool grew beyond its ceiling" : "");
+    }
+}
+
+/*
+ * This function is used to test separate pools in a multithreading context. Every thread allocates from a pool of its
+ * own, grows one of its blocks and tries to free another one through its neighbour's pool, which must leave it alone.
+ * The test passes if the pools never hand out each other's memory and every pool is whole again at the end.
+ */
+typedef struct
+{
+    thread_data_t *self;
+    mm_pool_t *pool;
+    mm_pool_t *other; // A pool the thread's blocks do not belong to
+    size_t pool_size;
+} pool_thread_data_t;
+
+void *thread_pool_blocks(void *arg)
+{
+    pool_thread_data_t *args = (pool_thread_data_t *)arg;
+    thread_data_t *data = args->self;
+    char **blocks = (char **)data->block_pointers;
+    intptr_t failures = 0;
+
+    for (int i = 0; i < data->num_blocks; i++)
+    {
+        blocks[i] = mm_alloc(args->pool, data->block_size);
+        if (blocks[i] == NULL)
+        {
+            failures++;
+            continue;
+        }
+        memset(blocks[i], data->thread_id, data->block_size);
+    }
+
+    if (blocks[0] != NULL)
+    {
+        char *grown = mm_resize(args->pool, blocks[0], 2 * data->block_size);
+        if (grown == NULL)
+        {
+            failures++;
+        }
+        else
+        {
+            sanityCheck(data->block_size, grown, data->thread_id);
+            memset(grown, data->thread_id, 2 * data->block_size);
+            blocks[0] = grown;
+        }
+    }
+    mm_free(args->other, blocks[1]);
+
+    my_barrier_wait(&barrier);
+
+    for (int i = 0; i < data->num_blocks; i++)
+    {
+        sanityCheck(i == 0 ? 2 * data->block_size : data->block_size, blocks[i], data->thread_id);
+        mm_free(args->pool, blocks[i]);
+    }
+
+    void *whole = mm_alloc(args->pool, args->pool_size);
+    if (whole == NULL)
+        failures++;
+    mm_free(args->pool, whole);
+
+    return (void *)failures;
+}
+
+void test_pools_multithread(TestParams params)
+{
+    printf_yellow("  Testing \"separate pools\" (threads: %d, memory_size: %zu) ---> ", params.num_threads, params.memory_size);
+
+    pthread_t threads[params.num_threads];
+    thread_data_t params_t[params.num_threads];
+    pool_thread_data_t args[params.num_threads];
+    mm_pool_t *pools[params.num_threads];
+
+    my_barrier_init(&barrier, params.num_threads);
+
+    int created = 0;
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        pools[i] = mm_create(params.memory_size);
+        if (pools[i] != NULL)
+            created++;
+    }
+    if (created < params.num_threads)
+    {
+        for (int i = 0; i < params.num_threads; i++)
+            mm_destroy(pools[i]);
+        my_barrier_destroy(&barrier);
+        printf_red("[FAIL]: only %d of %d pools were created.\n", created, params.num_threads);
+        return;
+    }
+
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        params_t[i].thread_id = i;
+        params_t[i].block_size = params.block_size;
+        params_t[i].num_blocks = params.memory_size / params.block_size / 2;
+        params_t[i].block_pointers = malloc(params_t[i].num_blocks * sizeof(void *));
+        args[i].self = &params_t[i];
+        args[i].pool = pools[i];
+        args[i].other = pools[(i + 1) % params.num_threads];
+        args[i].pool_size = params.memory_size;
+    }
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        pthread_create(&threads[i], NULL, thread_pool_blocks, &args[i]);
+    }
+
+    int failures = 0;
+    void *status;
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        pthread_join(threads[i], &status);
+        failures += (long)status;
+    }
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        free(params_t[i].block_pointers);
+        mm_destroy(pools[i]);
+    }
+    my_barrier_destroy(&barrier);
+
+    if (failures == 0)
+    {
+        printf_green("[PASS].\n");
+    }
+    else
+    {
+        printf_red("[FAIL]: %d allocations failed.\n", failures);
+    }
+}
+
+/*
+ * This function is used to test aligned allocations in a multithreading context. Every thread allocates blocks of
+ * alignments from 16 bytes to a page, frees every other block and allocates those again, so padding is split off
+ * both on the untouched tail and, in a second pass after the whole pool has been allocated and freed, inside the
+ * engine. With a minimum alignment set for the pool, plain allocations are checked against it instead. The test passes if every block is aligned, no data is overwritten and the pool is whole
+ * again at the end, so no padding is lost.
+ */
+typedef struct
+{
+    thread_data_t *self;
+    size_t align; // Minimum alignment of the pool, 0 to request alignments explicitly
+} aligned_thread_data_t;
+
+void *thread_aligned_blocks(void *arg)
+{
+    aligned_thread_data_t *args = (aligned_thread_data_t *)arg;
+    thread_data_t *data = args->self;
+    char **blocks = (char **)data->block_pointers;
+    intptr_t failures = 0;
+
+    for (int round = 0; round < 2; round++)
+    {
+        for (int i = round; i < data->num_blocks; i += round + 1)
+        {
+            size_t size = data->block_size + i % 3 * 24;
+            size_t align = args->align ? args->align : (size_t)16 << (i % 9);
+            blocks[i] = args->align ? mem_alloc(size) : mem_alloc_aligned(size, align);
+            if (blocks[i] == NULL || (uintptr_t)blocks[i] % align != 0)
+            {
+                failures++;
+                blocks[i] = NULL;
+                continue;
+            }
+            memset(blocks[i], data->thread_id, size);
+        }
+        if (round == 0)
+        {
+            for (int i = 1; i < data->num_blocks; i += 2)
+            {
+                mem_free(blocks[i]);
+            }
+        }
+    }
+
+    my_barrier_wait(&barrier);
+
+    for (int i = 0; i < data->num_blocks; i++)
+    {
+        sanityCheck(data->block_size + i % 3 * 24, blocks[i], data->thread_id);
+        mem_free(blocks[i]);
+    }
+
+    return (void *)failures;
+}
+
+void test_aligned_alloc_multithread(TestParams params, mem_engine_t engine, const char *engine_name, size_t align)
+{
+    printf_yellow("  Testing \"aligned allocation\" (engine: %s, threads: %d, pool alignment: %zu) ---> ", engine_name, params.num_threads, align);
+
+    pthread_t threads[params.num_threads];
+    thread_data_t params_t[params.num_threads];
+    aligned_thread_data_t args[params.num_threads];
+
+    my_barrier_init(&barrier, params.num_threads);
+    mem_init_config(params.memory_size, &(mem_config_t){.engine = engine, .align = align});
+
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        params_t[i].thread_id = i;
+        params_t[i].block_size = params.block_size;
+        params_t[i].num_blocks = params.num_blocks;
+        params_t[i].block_pointers = malloc(params.num_blocks * sizeof(void *));
+        args[i].self = &params_t[i];
+        args[i].align = align;
+    }
+
+    int failures = 0;
+    void *whole = NULL;
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (int i = 0; i < params.num_threads; i++)
+        {
+            pthread_create(&threads[i], NULL, thread_aligned_blocks, &args[i]);
+        }
+
+        void *status;
+        for (int i = 0; i < params.num_threads; i++)
+        {
+            pthread_join(threads[i], &status);
+            failures += (long)status;
+        }
+
+        // Allocating the whole pool uses up the untouched tail, so the next pass is placed by the engine
+        whole = mem_alloc(params.memory_size);
+        mem_free(whole);
+        if (whole == NULL)
+            break;
+    }
+    for (int i = 0; i < params.num_threads; i++)
+        free(params_t[i].block_pointers);
+
+    void *misaligned = mem_alloc_aligned(64, 48);
+
+    mem_deinit();
+    my_barrier_destroy(&barrier);
+
+    if (failures == 0 && whole != NULL && misaligned == NULL)
+    {
+        printf_green("[PASS].\n");
+    }
+    else
+    {
+        printf_red("[FAIL]: %d allocations failed or were misaligned%s%s.\n", failures, whole == NULL ? ", the pool was not whole again" : "", misaligned != NULL ? ", an alignment that is not a power of two was accepted" : "");
+    }
+}
+
+/*
+ * This function is used to test batch allocation and free in a multithreading context. Every thread allocates its
+ * blocks in batches of mixed sizes, zero and tiny sizes included, and frees the blocks of the next thread in batches,
+ * so a batch spans arenas. A batch with one block too large for the pool must fail as a whole.
+ * The test passes if every batch succeeds, no data is overwritten, the failed batch leaves nothing allocated and the
+ * pool is whole again at the end.
+ */
+void *thread_batch_blocks(void *arg)
+{
+    thread_data_t *data = ((arena_thread_data_t *)arg)->self;
+    thread_data_t *next = ((arena_thread_data_t *)arg)->next;
+    size_t sizes[data->iterations];
+    intptr_t failures = 0;
+
+    for (int i = 0; i < data->iterations; i++)
+        sizes[i] = i % 4 == 0 ? i % 8 : data->block_size + i * 40;
+
+    for (int first = 0; first < data->num_blocks; first += data->iterations)
+    {
+        if (!mem_alloc_batch(sizes, data->iterations, &data->block_pointers[first]))
+        {
+            failures++;
+            continue;
+        }
+        for (int i = 0; i < data->iterations; i++)
+            memset(data->block_pointers[first + i], data->thread_id, sizes[i]);
+    }
+
+    my_barrier_wait(&barrier);
+
+    for (int first = 0; first < next->num_blocks; first += next->iterations)
+    {
+        for (int i = 0; i < next->iterations; i++)
+            sanityCheck(sizes[i], next->block_pointers[first + i], next->thread_id);
+        mem_free_batch(&next->block_pointers[first], next->iterations);
+    }
+
+    return (void *)failures;
+}
+
+void test_batch_multithread(TestParams params, mem_engine_t engine, const char *engine_name)
+{
+    printf_yellow("  Testing \"mem_alloc_batch\" and \"mem_free_batch\" (engine: %s, threads: %d, batch: %d) ---> ", engine_name, params.num_threads, params.iterations);
+
+    pthread_t threads[params.num_threads];
+    thread_data_t params_t[params.num_threads];
+    arena_thread_data_t args[params.num_threads];
+
+    my_barrier_init(&barrier, params.num_threads);
+    mem_init_config(params.memory_size, &(mem_config_t){.engine = engine, .arenas = 2});
+
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        params_t[i].thread_id = i;
+        params_t[i].block_size = params.block_size;
+        params_t[i].iterations = params.iterations;
+        params_t[i].num_blocks = params.num_blocks / params.iterations * params.iterations;
+        params_t[i].block_pointers = calloc(params_t[i].num_blocks, sizeof(void *));
+        args[i].self = &params_t[i];
+        args[i].next = &params_t[(i + 1) % params.num_threads];
+    }
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        pthread_create(&threads[i], NULL, thread_batch_blocks, &args[i]);
+    }
+
+    int failures = 0;
+    void *status;
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        pthread_join(threads[i], &status);
+        failures += (long)status;
+    }
+    for (int i = 0; i < params.num_threads; i++)
+        free(params_t[i].block_pointers);
+
+    // The last block cannot fit, so the blocks before it must be given back
+    size_t sizes[] = {64, 1024, 8, params.memory_size + 1};
+    void *out[4] = {NULL};
+    bool oversized = mem_alloc_batch(sizes, 4, out);
+    bool cleared = out[0] == NULL && out[1] == NULL && out[2] == NULL && out[3] == NULL;
+
+    // Both arenas must be whole again
+    size_t halves[] = {params.memory_size / 2, params.memory_size / 2};
+    bool whole = mem_alloc_batch(halves, 2, out);
+    if (whole)
+        mem_free_batch(out, 2);
+
+    mem_deinit();
+    my_barrier_destroy(&barrier);
+
+    if (failures == 0 && !oversized && cleared && whole)
+    {
+        printf_green("[PASS].\n");
+    }
+    else
+    {
+        printf_red("[FAIL]: %d batches failed%s%s.\n", failures, oversized || !cleared ? ", an oversized batch was not rejected whole" : "", whole ? "" : ", the pool was not whole again");
+    }
+}
+
+/*
+ * This function is used to test freeing blocks on other threads than the ones that allocated them. Threads work in
+ * pairs: the producer allocates blocks and hands each one to its consumer, which checks and frees it. The producers
+ * allocate several times the pool in total, so they only keep going if the blocks their consumers free are returned
+ * to the producers' arenas. The test passes if no data is overwritten, no block is lost and every arena is whole again
+ * at the end.
+ */
+typedef struct
+{
+    thread_data_t *self;
+    _Atomic(void *) *slots; // Blocks handed from the producer to the consumer, in order
+    bool producer;
+} pipeline_thread_data_t;
+
+void *thread_pipeline(void *arg)
+{
+    pipeline_thread_data_t *args = (pipeline_thread_data_t *)arg;
+    thread_data_t *data = args->self;
+    intptr_t failures = 0;
+
+    for (int i = 0; i < data->num_blocks; i++)
+    {
+        if (args->producer)
+        {
+            char *block = NULL;
+            for (int attempt = 0; block == NULL && attempt < 1000000; attempt++)
+            {
+                block = mem_alloc(data->block_size);
+                if (block == NULL)
+                    sched_yield();
+            }
+            if (block == NULL)
+            {
+                failures++;
+                break;
+            }
+            memset(block, (char)i, data->block_size);
+            atomic_store_explicit(&args->slots[i], block, memory_order_release);
+        }
+        else
+        {
+            char *block;
+            while ((block = atomic_load_explicit(&args->slots[i], memory_order_acquire)) == NULL)
+                sched_yield();
+            if (block == (char *)-1)
+                break;
+            sanityCheck(data->block_size, block, (char)i);
+            mem_free(block);
+        }
+    }
+    if (args->producer && failures)
+    {
+        for (int i = 0; i < data->num_blocks; i++)
+            if (atomic_load_explicit(&args->slots[i], memory_order_relaxed) == NULL)
+                atomic_store_explicit(&args->slots[i], (void *)-1, memory_order_release);
+    }
+
+    return (void *)failures;
+}
+
+void test_remote_free_multithread(TestParams params)
+{
+    printf_yellow("  Testing \"remote free\" (threads: %d, arenas: %d, blocks: %d) ---> ", params.num_threads, params.iterations, params.num_blocks);
+
+    pthread_t threads[params.num_threads];
+    thread_data_t params_t[params.num_threads];
+    pipeline_thread_data_t args[params.num_threads];
+    _Atomic(void *) *slots[params.num_threads / 2];
+    size_t arena_size = params.memory_size / params.iterations;
+
+    mem_init_config(params.memory_size, &(mem_config_t){.arenas = params.iterations});
+
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        if (i % 2 == 0)
+            slots[i / 2] = calloc(params.num_blocks, sizeof(void *));
+        params_t[i].thread_id = i;
+        params_t[i].block_size = params.block_size;
+        params_t[i].num_blocks = params.num_blocks;
+        args[i].self = &params_t[i];
+        args[i].slots = slots[i / 2];
+        args[i].producer = i % 2 == 0;
+    }
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        pthread_create(&threads[i], NULL, thread_pipeline, &args[i]);
+    }
+
+    int failures = 0;
+    void *status;
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        pthread_join(threads[i], &status);
+        failures += (long)status;
+    }
+    for (int i = 0; i < params.num_threads / 2; i++)
+        free(slots[i]);
+
+    // Every arena must be whole again, one arena-sized block each
+    void *blocks[params.iterations];
+    int whole = 0;
+    for (int i = 0; i < params.iterations; i++)
+    {
+        blocks[i] = mem_alloc(arena_size);
+        if (blocks[i] != NULL)
+            whole++;
+    }
+    for (int i = 0; i < params.iterations; i++)
+        mem_free(blocks[i]);
+
+    mem_deinit();
+
+    if (failures == 0 && whole == params.iterations)
+    {
+        printf_green("[PASS].\n");
+    }
+    else
+    {
+        printf_red("[FAIL]: %d producers ran out of memory, %d of %d arenas were whole.\n", failures, whole, params.iterations);
+    }
+}
+
+/*
+ * This function is used to test per-CPU locked caches with many more threads than CPUs. Every thread allocates small blocks,
+ * fills them, frees them into the cache of the CPU it runs on and allocates them again for a number of rounds, so
+ * blocks cached by one thread are handed to others on the same CPU. The pool holds exactly the blocks all threads keep
+ * at once, so an allocation only succeeds if cached blocks are given back when the pool runs dry.
+ * The test passes if no allocation fails, no data is overwritten and the pool is whole again at the end.
+ */
+void *thread_cpu_cache(void *arg)
+{
+    thread_data_t *data = (thread_data_t *)arg;
+    char **blocks = (char **)data->block_pointers;
+    intptr_t failures = 0;
+
+    for (int round = 0; round < data->iterations; round++)
+    {
+        for (int i = 0; i < data->num_blocks; i++)
+        {
+            blocks[i] = mem_alloc(data->block_size);
+            if (blocks[i] == NULL)
+            {
+                failures++;
+                continue;
+            }
+            memset(blocks[i], data->thread_id, data->block_size);
+        }
+        for (int i = 0; i < data->num_blocks; i++)
+        {
+            sanityCheck(data->block_size, blocks[i], data->thread_id);
+            mem_free(blocks[i]);
+        }
+    }
+
+    return (void *)failures;
+}
+
+void test_cpu_caches_multithread(TestParams params)
+{
+    printf_yellow("  Testing \"per-CPU locked caches\" (threads: %d, blocks: %d, block_size: %zu) ---> ", params.num_threads, params.num_blocks, params.block_size);
+
+    pthread_t threads[params.num_threads];
+    thread_data_t params_t[params.num_threads];
+    size_t mem_size = params.num_threads * params.num_blocks * params.block_size;
+
+    mem_init_config(mem_size, &(mem_config_t){.cpuCaches = true});
+
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        params_t[i].thread_id = i;
+        params_t[i].num_blocks = params.num_blocks;
+        params_t[i].block_size = params.block_size;
+        params_t[i].iterations = params.iterations;
+        params_t[i].block_pointers = malloc(params.num_blocks * sizeof(void *));
+        pthread_create(&threads[i], NULL, thread_cpu_cache, &params_t[i]);
+    }
+
+    int failures = 0;
+    void *status;
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        pthread_join(threads[i], &status);
+        failures += (long)status;
+        free(params_t[i].block_pointers);
+    }
+
+    void *whole = mem_alloc(mem_size);
+    mem_free(whole);
+
+    mem_deinit();
+
+    if (failures == 0 && whole != NULL)
+    {
+        printf_green("[PASS].\n");
+    }
+    else
+    {
+        printf_red("[FAIL]: %d allocations failed%s.\n", failures, whole == NULL ? ", cached blocks were not returned to the pool" : "");
+    }
+}
+
+/*
+ * This function is used to test a NUMA pool in a multithreading context. The pool gets one arena per node, bound to
+ * it, and every thread allocates from the arena of the node it runs on. On a single node machine the pool has a single
+ * arena bound to node 0, so the same code runs everywhere.
+ * The test passes if no allocation fails, no data is overwritten and, where the kernel lets the memory policy be read,
+ * a block allocated by this thread lies in memory preferring the node the thread runs on.
+ */
+void test_numa_arenas_multithread(TestParams params)
+{
+    printf_yellow("  Testing \"NUMA arenas\" (threads: %d, memory_size: %zu) ---> ", params.num_threads, params.memory_size);
+
+    pthread_t threads[params.num_threads];
+    thread_data_t params_t[params.num_threads];
+    arena_thread_data_t args[params.num_threads];
+
+    my_barrier_init(&barrier, params.num_threads);
+    mem_init_config(params.memory_size, &(mem_config_t){.numa = true});
+
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        params_t[i].thread_id = i;
+        params_t[i].block_size = params.block_size;
+        params_t[i].num_blocks = params.memory_size / params.num_threads / params.block_size / 4;
+        params_t[i].block_pointers = malloc(params_t[i].num_blocks * sizeof(void *));
+        args[i].self = &params_t[i];
+        args[i].next = &params_t[(i + 1) % params.num_threads];
+    }
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        pthread_create(&threads[i], NULL, thread_arena_blocks, &args[i]);
+    }
+
+    int failures = 0;
+    void *status;
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        pthread_join(threads[i], &status);
+        failures += (long)status;
+    }
+    for (int i = 0; i < params.num_threads; i++)
+        free(params_t[i].block_pointers);
+
+    // The block is touched so its page exists, then its policy is read back
+    bool local = true;
+    unsigned int cpu, node;
+    char *block = mem_alloc(params.block_size);
+    if (block != NULL && getcpu(&cpu, &node) == 0)
+    {
+        memset(block, 1, params.block_size);
+        int mode;
+        unsigned long mask[16] = {0};
+        if (syscall(SYS_get_mempolicy, &mode, mask, sizeof(mask) * 8, block, MPOL_F_ADDR) == 0)
+            local = mode == MPOL_PREFERRED && (mask[node / 64] & (1UL << (node % 64)));
+    }
+    mem_free(block);
+
+    mem_deinit();
+    my_barrier_destroy(&barrier);
+
+    if (failures == 0 && block != NULL && local)
+    {
+        printf_green("[PASS].\n");
+    }
+    else
+    {
+        printf_red("[FAIL]: %d allocations failed%s.\n", failures, local ? "" : ", a block was not bound to the local node");
+    }
+}
+
+/*
+ * This function is used to test regions in a multithreading context. Every thread begins a region of its own and,
+ * for a number of rounds, allocates blocks of several sizes, marks the region, allocates more, checks every block and
+ * resets the region to the mark, so the blocks after the mark are handed out again at the same addresses. Each round
+ * ends with a reset to the mark taken before its first block.
+ * The test passes if no allocation fails, every block is aligned for any type, no data is overwritten, a reset hands
+ * out the same memory again and the pool is whole once every region has ended.
+ */
+void *thread_region(void *arg)
+{
+    thread_data_t *data = (thread_data_t *)arg;
+    char **blocks = (char **)data->block_pointers;
+    intptr_t failures = 0;
+    mem_region_t *region = mem_region_begin(0);
+    if (region == NULL)
+        return (void *)(intptr_t)1;
+
+    for (int round = 0; round < data->iterations; round++)
+    {
+        mem_region_mark_t start = mem_region_mark(region);
+        for (int i = 0; i < data->num_blocks; i++)
+        {
+            size_t size = data->block_size * (1 + i % 4);
+            blocks[i] = mem_region_alloc(region, size);
+            if (blocks[i] == NULL || (uintptr_t)blocks[i] % _Alignof(max_align_t) != 0)
+                failures++;
+            else
+                memset(blocks[i], data->thread_id, size);
+        }
+
+        mem_region_mark_t mark = mem_region_mark(region);
+        char *first = NULL;
+        for (int pass = 0; pass < 2; pass++)
+        {
+            for (int i = 0; i < data->num_blocks; i++)
+            {
+                char *block = mem_region_alloc(region, data->block_size);
+                if (block == NULL)
+                {
+                    failures++;
+                    continue;
+                }
+                if (i == 0 && pass == 0)
+                    first = block;
+                else if (i == 0 && block != first)
+                    failures++;
+                memset(block, data->thread_id + 1, data->block_size);
+            }
+            mem_region_reset(region, mark);
+        }
+
+        for (int i = 0; i < data->num_blocks; i++)
+        {
+            if (blocks[i] != NULL)
+                sanityCheck(data->block_size * (1 + i % 4), blocks[i], data->thread_id);
+        }
+        mem_region_reset(region, start);
+    }
+
+    mem_region_end(region);
+    return (void *)failures;
+}
+
+void test_region_multithread(TestParams params)
+{
+    printf_yellow("  Testing \"regions\" (threads: %d, blocks: %d, block_size: %zu) ---> ", params.num_threads, params.num_blocks, params.block_size);
+
+    pthread_t threads[params.num_threads];
+    thread_data_t params_t[params.num_threads];
+
+    mem_init(params.memory_size);
+
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        params_t[i].thread_id = i;
+        params_t[i].num_blocks = params.num_blocks;
+        params_t[i].block_size = params.block_size;
+        params_t[i].iterations = params.iterations;
+        params_t[i].block_pointers = malloc(params.num_blocks * sizeof(void *));
+        pthread_create(&threads[i], NULL, thread_region, &params_t[i]);
+    }
+
+    int failures = 0;
+    void *status;
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        pthread_join(threads[i], &status);
+        failures += (long)status;
+        free(params_t[i].block_pointers);
+    }
+
+    void *whole = mem_alloc(params.memory_size);
+    mem_free(whole);
+
+    mem_deinit();
+
+    if (failures == 0 && whole != NULL)
+    {
+        printf_green("[PASS].\n");
+    }
+    else
+    {
+        printf_red("[FAIL]: %d region allocations failed%s.\n", failures, whole == NULL ? ", chunks were not returned to the pool" : "");
+    }
+}
+
+/*
+ * This function is used to test resetting a whole pool. For a number of rounds, threads allocate blocks and keep them,
+ * more than the pool holds so it grows by chunks, and the main thread leaves a few blocks in its thread cache. The
+ * pool is then reset instead of freeing anything.
+ * The test passes if no allocation fails, no data is overwritten and after every reset the pool is whole again, with
+ * no cached block handed out from inside it.
+ */
+void *thread_keep_blocks(void *arg)
+{
+    thread_data_t *data = (thread_data_t *)arg;
+    intptr_t failures = 0;
+
+    for (int i = 0; i < data->num_blocks; i++)
+    {
+        data->block_pointers[i] = mem_alloc(data->block_size);
+        if (data->block_pointers[i] == NULL)
+        {
+            failures++;
+            continue;
+        }
+        memset(data->block_pointers[i], data->thread_id, data->block_size);
+    }
+    for (int i = 0; i < data->num_blocks; i++)
+    {
+        if (data->block_pointers[i] != NULL)
+            sanityCheck(data->block_size, data->block_pointers[i], data->thread_id);
+    }
+
+    return (void *)failures;
+}
+
+void test_reset_multithread(TestParams params)
+{
+    printf_yellow("  Testing \"pool reset\" (threads: %d, rounds: %d, memory_size: %zu) ---> ", params.num_threads, params.iterations, params.memory_size);
+
+    pthread_t threads[params.num_threads];
+    thread_data_t params_t[params.num_threads];
+    int failures = 0;
+    int whole = 0;
+
+    mem_init_config(params.memory_size, &(mem_config_t){.maxSize = 4 * params.memory_size});
+
+    for (int round = 0; round < params.iterations; round++)
+    {
+        for (int i = 0; i < params.num_threads; i++)
+        {
+            params_t[i].thread_id = i;
+            params_t[i].num_blocks = params.num_blocks;
+            params_t[i].block_size = params.block_size;
+            params_t[i].block_pointers = malloc(params.num_blocks * sizeof(void *));
+            pthread_create(&threads[i], NULL, thread_keep_blocks, &params_t[i]);
+        }
+
+        void *status;
+        for (int i = 0; i < params.num_threads; i++)
+        {
+            pthread_join(threads[i], &status);
+            failures += (long)status;
+            free(params_t[i].block_pointers);
+        }
+
+        // These blocks stay in the main thread's cache
+        for (int i = 0; i < 16; i++)
+            mem_free(mem_alloc(64));
+
+        mem_reset();
+
+        char *block = mem_alloc(params.memory_size);
+        char *cached = mem_alloc(64);
+        if (block != NULL && (cached < block || cached >= block + params.memory_size))
+            whole++;
+        mem_free(cached);
+        mem_free(block);
+    }
+
+    mem_deinit();
+
+    if (failures == 0 && whole == params.iterations)
+    {
+        printf_green("[PASS].\n");
+    }
+    else
+    {
+        printf_red("[FAIL]: %d allocations failed, the pool was whole after %d of %d resets.\n", failures, whole, params.iterations);
+    }
+}
+
+/*
+ * This function is used to test allocations from the untouched tail of the pool in a multithreading context.
+ * Every thread fills its share of the pool while it has never been fragmented, frees every other block, and then
+ * allocates the same number of blocks again, which only fits if the blocks freed from the tail are reused.
+ * The test passes if every allocation succeeds, no data is overwritten and the pool is whole again at the end.
+ */
+void *thread_bump_tail(void *arg)
+{
+    thread_data_t *data = (thread_data_t *)arg;
+    char **blocks = (char **)data->block_pointers;
+    intptr_t failures = 0;
+
+    for (int i = 0; i < data->num_blocks; i++)
+    {
+        blocks[i] = mem_alloc(data->block_size);
+        if (blocks[i] == NULL)
+        {
+            failures++;
+            continue;
+        }
+        memset(blocks[i], data->thread_id, data->block_size);
+    }
+
+    my_barrier_wait(&barrier);
+
+    for (int i = 1; i < data->num_blocks; i += 2)
+    {
+        mem_free(blocks[i]);
+        blocks[i] = NULL;
+    }
+
+    my_barrier_wait(&barrier);
+
+    for (int i = 1; i < data->num_blocks; i += 2)
+    {
+        blocks[i] = mem_alloc(data->block_size);
+        if (blocks[i] == NULL)
+        {
+            failures++;
+            continue;
+        }
+        memset(blocks[i], data->thread_id, data->block_size);
+    }
+
+    my_barrier_wait(&barrier);
+
+    for (int i = 0; i < data->num_blocks; i++)
+    {
+        if (blocks[i] == NULL)
+            continue;
+        sanityCheck(data->block_size, blocks[i], data->thread_id);
+        mem_free(blocks[i]);
+    }
+
+    return (void *)failures;
+}
+
+void test_bump_tail_multithread(TestParams params)
+{
+    printf_yellow("  Testing \"untouched tail\" (threads: %d, blocks: %d, block_size: %zu) ---> ", params.num_threads, params.num_blocks, params.block_size);
+
+    pthread_t threads[params.num_threads];
+    thread_data_t params_t[params.num_threads];
+    size_t mem_size = params.num_threads * params.num_blocks * params.block_size;
+
+    my_barrier_init(&barrier, params.num_threads);
+    mem_init(mem_size);
+
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        params_t[i].thread_id = i;
+        params_t[i].num_blocks = params.num_blocks;
+        params_t[i].block_size = params.block_size;
+        params_t[i].block_pointers = malloc(params.num_blocks * sizeof(void *));
+        pthread_create(&threads[i], NULL, thread_bump_tail, &params_t[i]);
+    }
+
+    int failures = 0;
+    void *status;
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        pthread_join(threads[i], &status);
+        failures += (long)status;
+        free(params_t[i].block_pointers);
+    }
+
+    void *whole = mem_alloc(mem_size);
+    my_assert(whole != NULL);
+    mem_free(whole);
+
+    mem_deinit();
+    my_barrier_destroy(&barrier);
+
+    if (failures == 0 && whole != NULL)
+    {
+        printf_green("[PASS].\n");
+    }
+    else
+    {
+        printf_red("[FAIL]: %d allocations failed.\n", failures);
+    }
+}
+
+size_t tiny_block_size(int thread_id, int i)
+{
+    return 1 + (i * 13 + thread_id) % 64;
+}
+
+void *thread_tiny_blocks(void *arg)
+{
+    thread_data_t *data = (thread_data_t *)arg;
+    char **blocks = (char **)data->block_pointers;
+    intptr_t failures = 0;
+
+    for (int i = 0; i < data->num_blocks; i++)
+    {
+        blocks[i] = mem_alloc(tiny_block_size(data->thread_id, i));
+        if (blocks[i] == NULL)
+        {
+            failures++;
+            continue;
+        }
+        memset(blocks[i], data->thread_id, tiny_block_size(data->thread_id, i));
+    }
+
+    my_barrier_wait(&barrier);
+
+    for (int i = 1; i < data->num_blocks; i += 2)
+    {
+        mem_free(blocks[i]);
+        blocks[i] = NULL;
+    }
+
+    my_barrier_wait(&barrier);
+
+    // Refill the holes, and move every other block out of its slot
+    for (int i = 0; i < data->num_blocks; i++)
+    {
+        size_t size = tiny_block_size(data->thread_id, i);
+        if (i % 2 == 1)
+        {
+            blocks[i] = mem_alloc(size);
+            if (blocks[i] != NULL)
+                memset(blocks[i], data->thread_id, size);
+        }
+        else if (i % 4 == 0 && blocks[i] != NULL)
+        {
+            char *resized = mem_resize(blocks[i], 80);
+            if (resized != NULL)
+            {
+                sanityCheck(size, resized, data->thread_id);
+                memset(resized, data->thread_id, 80);
+            }
+            blocks[i] = resized;
+        }
+        if (blocks[i] == NULL)
+            failures++;
+    }
+
+    my_barrier_wait(&barrier);
+
+    for (int i = 0; i < data->num_blocks; i++)
+    {
+        if (blocks[i] == NULL)
+            continue;
+        size_t size = i % 4 == 0 ? 80 : tiny_block_size(data->thread_id, i);
+        sanityCheck(size, blocks[i], data->thread_id);
+        mem_free(blocks[i]);
+    }
+
+    return (void *)failures;
+}
+
+void test_tiny_blocks_multithread(TestParams params)
+{
+    printf_yellow("  Testing \"tiny blocks\" (threads: %d, blocks: %d) ---> ", params.num_threads, params.num_blocks);
+
+    pthread_t threads[params.num_threads];
+    thread_data_t params_t[params.num_threads];
+    size_t mem_size = params.num_threads * params.num_blocks * 64;
+
+    my_barrier_init(&barrier, params.num_threads);
+    mem_init(mem_size);
+
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        params_t[i].thread_id = i;
+        params_t[i].num_blocks = params.num_blocks;
+        params_t[i].block_pointers = malloc(params.num_blocks * sizeof(void *));
+        pthread_create(&threads[i], NULL, thread_tiny_blocks, &params_t[i]);
+    }
+
+    int failures = 0;
+    void *status;
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        pthread_join(threads[i], &status);
+        failures += (long)status;
+        free(params_t[i].block_pointers);
+    }
+
+    // Every run must give its space back once its slots are free
+    void *whole = mem_alloc(mem_size);
+    mem_free(whole);
+
+    mem_deinit();
+    my_barrier_destroy(&barrier);
+
+    if (failures == 0 && whole != NULL)
+    {
+        printf_green("[PASS].\n");
+    }
+    else
+    {
+        printf_red("[FAIL]: %d allocations failed%s.\n", failures, whole == NULL ? ", pool not reusable" : "");
+    }
+}
+
+/*
+ * This function checks where each placement policy puts blocks in a pool with holes of known sizes.
+ * The pool is laid out as A h1 B h2 C h3 D h4 with the holes freed, then three blocks are placed with one freed in between.
+ */
+bool check_placement_policy(mem_policy_t policy, const size_t expected[3])
+{
+    size_t layout[] = {400, 1200, 400, 600, 400, 800, 400, 600};
+    void *blocks[8];
+
+    mem_set_policy(policy);
+    mem_init_config(4800, &(mem_config_t){.engine = MEM_ENGINE_LIST});
+    char *base = mem_alloc(layout[0]);
+    blocks[0] = base;
+    for (int i = 1; i < 8; i++)
+        blocks[i] = mem_alloc(layout[i]);
+    for (int i = 1; i < 8; i += 2)
+        mem_free(blocks[i]);
+
+    char *x = mem_alloc(800);
+    char *y = mem_alloc(560);
+    mem_free(x);
+    char *z = mem_alloc(480);
+
+    bool placed = x == base + expected[0] && y == base + expected[1] && z == base + expected[2];
+    mem_deinit();
+    return placed;
+}
+
+void test_placement_policies()
+{
+    printf_yellow("  Testing \"placement policies\" ---> ");
+
+    static const size_t expected[4][3] = {
+        {400, 2000, 400},  // First fit
+        {400, 2000, 3000}, // Next fit resumes after y
+        {3000, 2000, 4200}, // Best fit takes the exact and the tightest holes
+        {400, 3000, 400},  // Worst fit takes the largest holes
+    };
+    static const char *names[] = {"first", "next", "best", "worst"};
+
+    int wrong = -1;
+    for (int p = 0; p < 4 && wrong < 0; p++)
+    {
+        if (!check_placement_policy(p, expected[p]))
+            wrong = p;
+    }
+    mem_set_policy(MEM_POLICY_FIRST_FIT);
+
+    if (wrong < 0)
+    {
+        printf_green("[PASS].\n");
+    }
+    else
+    {
+        printf_red("[FAIL]: %s fit placed a block in the wrong hole.\n", names[wrong]);
+    }
+}
+
+void *thread_best_fit_churn(void *arg)
+{
+    thread_data_t *data = (thread_data_t *)arg;
+    char **blocks = (char **)data->block_pointers;
+    size_t sizes[data->num_blocks];
+    unsigned int seed = data->thread_id;
+    intptr_t failures = 0;
+
+    memset(blocks, 0, data->num_blocks * sizeof(char *));
+    for (int i = 0; i < data->iterations; i++)
+    {
+        int slot = rand_r(&seed) % data->num_blocks;
+        if (blocks[slot] != NULL)
+        {
+            sanityCheck(sizes[slot], blocks[slot], data->thread_id);
+            mem_free(blocks[slot]);
+            blocks[slot] = NULL;
+            continue;
+        }
+        sizes[slot] = 300 + rand_r(&seed) % (data->max_block_size - 300);
+        blocks[slot] = mem_alloc(sizes[slot]);
+        if (blocks[slot] == NULL)
+            failures++;
+        else
+            memset(blocks[slot], data->thread_id, sizes[slot]);
+    }
+
+    for (int i = 0; i < data->num_blocks; i++)
+    {
+        if (blocks[i] == NULL)
+            continue;
+        sanityCheck(sizes[i], blocks[i], data->thread_id);
+        mem_free(blocks[i]);
+    }
+
+    return (void *)failures;
+}
+
+void test_best_fit_churn_multithread(TestParams params)
+{
+    printf_yellow("  Testing \"best fit churn\" (threads: %d, blocks: %d, iterations: %d) ---> ", params.num_threads, params.num_blocks, params.iterations);
+
+    pthread_t threads[params.num_threads];
+    thread_data_t params_t[params.num_threads];
+    size_t mem_size = 2 * params.num_threads * params.num_blocks * params.block_size;
+
+    // Twice what can be live at once, so fragmentation never fails a request
+    mem_set_policy(MEM_POLICY_BEST_FIT);
+    mem_init_config(mem_size, &(mem_config_t){.engine = MEM_ENGINE_LIST});
+
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        params_t[i].thread_id = i;
+        params_t[i].num_blocks = params.num_blocks;
+        params_t[i].iterations = params.iterations;
+        params_t[i].max_block_size = params.block_size;
+        params_t[i].block_pointers = malloc(params.num_blocks * sizeof(void *));
+        pthread_create(&threads[i], NULL, thread_best_fit_churn, &params_t[i]);
+    }
+
+    int failures = 0;
+    void *status;
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        pthread_join(threads[i], &status);
+        failures += (long)status;
+        free(params_t[i].block_pointers);
+    }
+
+    // The gaps must have merged back into one
+    void *whole = mem_alloc(mem_size);
+    mem_free(whole);
+
+    mem_deinit();
+    mem_set_policy(MEM_POLICY_FIRST_FIT);
+
+    if (failures == 0 && whole != NULL)
+    {
+        printf_green("[PASS].\n");
+    }
+    else
+    {
+        printf_red("[FAIL]: %d allocations failed%s.\n", failures, whole == NULL ? ", pool not reusable" : "");
+    }
+}
+
+void *thread_handle_compaction(void *arg)
+{
+    thread_data_t *data = (thread_data_t *)arg;
+    mem_handle_t **handles = (mem_handle_t **)data->block_pointers;
+    intptr_t failures = 0;
+
+    for (int i = 0; i < data->num_blocks; i++)
+    {
+        handles[i] = mem_halloc(data->block_size);
+        if (handles[i] == NULL)
+        {
+            failures++;
+            continue;
+        }
+        memset(mem_hlock(handles[i]), data->thread_id, data->block_size);
+        mem_hunlock(handles[i]);
+    }
+
+    my_barrier_wait(&barrier);
+
+    // Leave a hole after every other block
+    for (int i = 1; i < data->num_blocks; i += 2)
+    {
+        mem_hfree(handles[i]);
+        handles[i] = NULL;
+    }
+
+    my_barrier_wait(&barrier);
+
+    // Keep locking the remaining blocks while the main thread compacts
+    for (int round = 0; round < data->iterations; round++)
+    {
+        for (int i = 0; i < data->num_blocks; i += 2)
+        {
+            if (handles[i] == NULL)
+                continue;
+            sanityCheck(data->block_size, mem_hlock(handles[i]), data->thread_id);
+            mem_hunlock(handles[i]);
+        }
+    }
+
+    my_barrier_wait(&barrier);
+    my_barrier_wait(&barrier);
+
+    for (int i = 0; i < data->num_blocks; i += 2)
+    {
+        if (handles[i] == NULL)
+            continue;
+        sanityCheck(data->block_size, mem_hlock(handles[i]), data->thread_id);
+        mem_hunlock(handles[i]);
+        mem_hfree(handles[i]);
+    }
+
+    return (void *)failures;
+}
+
+void test_handle_compaction_multithread(TestParams params)
+{
+    printf_yellow("  Testing \"handle compaction\" (threads: %d, blocks: %d, block_size: %zu) ---> ", params.num_threads, params.num_blocks, params.block_size);
+
+    pthread_t threads[params.num_threads];
+    thread_data_t params_t[params.num_threads];
+    size_t mem_size = params.num_threads * params.num_blocks * params.block_size;
+
+    my_barrier_init(&barrier, params.num_threads + 1);
+    mem_init_config(mem_size, &(mem_config_t){.engine = MEM_ENGINE_LIST});
+
+    // A request larger than all the free memory cannot be helped by compaction, so it must leave the hole in place
+    mem_handle_t *first = mem_halloc(params.block_size);
+    mem_handle_t *second = mem_halloc(params.block_size);
+    mem_hfree(first);
+    bool hopeless_compacted = mem_alloc(mem_size) == NULL && mem_compact() == 0;
+    mem_hfree(second);
+
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        params_t[i].thread_id = i;
+        params_t[i].num_blocks = params.num_blocks;
+        params_t[i].block_size = params.block_size;
+        params_t[i].iterations = params.iterations;
+        params_t[i].block_pointers = malloc(params.num_blocks * sizeof(void *));
+        pthread_create(&threads[i], NULL, thread_handle_compaction, &params_t[i]);
+    }
+
+    my_barrier_wait(&barrier);
+    my_barrier_wait(&barrier);
+
+    // Compact while the workers lock their blocks; blocks locked at the time
+    // stay where they are
+    for (int i = 0; i < params.iterations / 10; i++)
+        mem_compact();
+    my_barrier_wait(&barrier);
+
+    // Half the pool is free, but only fits once the failed allocation has
+    // compacted the blocks that were locked above
+    void *tail = mem_alloc(mem_size / 2);
+    my_barrier_wait(&barrier);
+
+    int failures = 0;
+    void *status;
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        pthread_join(threads[i], &status);
+        failures += (long)status;
+        free(params_t[i].block_pointers);
+    }
+
+    mem_free(tail);
+    mem_deinit();
+    my_barrier_destroy(&barrier);
+
+    if (failures == 0 && tail != NULL && !hopeless_compacted)
+    {
+        printf_green("[PASS].\n");
+    }
+    else if (hopeless_compacted)
+    {
+        printf_red("[FAIL]: A request no compaction could fit compacted the pool.\n");
+    }
+    else
+    {
+        printf_red("[FAIL]: %d handle allocations failed%s.\n", failures, tail == NULL ? ", pool was not compacted" : "");
+    }
+}
+
+void *thread_trim(void *arg)
+{
+    thread_data_t *data = (thread_data_t *)arg;
+    char **blocks = (char **)data->block_pointers;
+    intptr_t failures = 0;
+
+    for (int i = 0; i < data->num_blocks; i++)
+    {
+        blocks[i] = mem_alloc(data->block_size);
+        if (blocks[i] == NULL)
+            failures++;
+        else
+            memset(blocks[i], data->thread_id + 1, data->block_size);
+    }
+
+    // Free every other block, leaving holes of whole pages between live blocks
+    for (int i = 1; i < data->num_blocks; i += 2)
+        mem_free(blocks[i]);
+    my_barrier_wait(&barrier);
+    my_barrier_wait(&barrier);
+
+    // Live blocks keep their data, and the holes can be used again
+    for (int i = 0; i < data->num_blocks; i += 2)
+    {
+        if (blocks[i] != NULL)
+            sanityCheck(data->block_size, blocks[i], data->thread_id + 1);
+    }
+    for (int i = 1; i < data->num_blocks; i += 2)
+    {
+        blocks[i] = mem_alloc(data->block_size);
+        if (blocks[i] == NULL)
+            failures++;
+        else
+            memset(blocks[i], data->thread_id + 1, data->block_size);
+    }
+    for (int i = 0; i < data->num_blocks; i++)
+    {
+        if (blocks[i] == NULL)
+            continue;
+        sanityCheck(data->block_size, blocks[i], data->thread_id + 1);
+        mem_free(blocks[i]);
+    }
+
+    return (void *)failures;
+}
+
+/*
+ * This function checks that free pages between live blocks are given back to the kernel, either by mem_trim or once
+ * threshold bytes have been freed, without touching the data of the live blocks.
+ */
+void test_trim_multithread(TestParams params, size_t threshold)
+{
+    printf_yellow("  Testing \"%s\" (threads: %d, blocks: %d, block_size: %zu) ---> ", threshold ? "automatic trim" : "trim", params.num_threads, params.num_blocks, params.block_size);
+
+    pthread_t threads[params.num_threads];
+    thread_data_t params_t[params.num_threads];
+    size_t mem_size = params.num_threads * params.num_blocks * params.block_size;
+
+    my_barrier_init(&barrier, params.num_threads + 1);
+    if (threshold)
+        mem_init_config(mem_size, &(mem_config_t){.engine = MEM_ENGINE_LIST, .trimThreshold = threshold});
+    else
+        mem_init(mem_size);
+
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        params_t[i].thread_id = i;
+        params_t[i].num_blocks = params.num_blocks;
+        params_t[i].block_size = params.block_size;
+        params_t[i].block_pointers = malloc(params.num_blocks * sizeof(void *));
+        pthread_create(&threads[i], NULL, thread_trim, &params_t[i]);
+    }
+
+    my_barrier_wait(&barrier);
+    size_t trimmed = threshold ? 0 : mem_trim();
+
+    // A page inside the first block freed must no longer be resident
+    long page_size = sysconf(_SC_PAGESIZE);
+    uintptr_t page = ((uintptr_t)params_t[0].block_pointers[1] + page_size - 1) & ~(uintptr_t)(page_size - 1);
+    unsigned char resident = 1;
+    if (params_t[0].block_pointers[1] != NULL)
+        mincore((void *)page, page_size, &resident);
+    my_barrier_wait(&barrier);
+
+    int failures = 0;
+    void *status;
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        pthread_join(threads[i], &status);
+        failures += (long)status;
+        free(params_t[i].block_pointers);
+    }
+
+    mem_deinit();
+    my_barrier_destroy(&barrier);
+
+    if (failures == 0 && (threshold || trimmed > 0) && !(resident & 1))
+    {
+        printf_green("[PASS].\n");
+    }
+    else
+    {
+        printf_red("[FAIL]: %d allocations failed%s.\n", failures, (resident & 1) ? ", freed pages still resident" : "");
+    }
+}
+
+void *thread_reserved_pool(void *arg)
+{
+    thread_data_t *data = (thread_data_t *)arg;
+    char **blocks = (char **)data->block_pointers;
+    intptr_t failures = 0;
+
+    for (int i = 0; i < data->num_blocks; i++)
+    {
+        blocks[i] = mem_alloc(data->block_size);
+        if (blocks[i] == NULL)
+            failures++;
+        else
+            memset(blocks[i], data->thread_id + 1, data->block_size);
+    }
+    for (int i = 0; i < data->num_blocks; i++)
+    {
+        if (blocks[i] == NULL)
+            continue;
+        sanityCheck(data->block_size, blocks[i], data->thread_id + 1);
+        mem_free(blocks[i]);
+    }
+
+    return (void *)failures;
+}
+
+/*
+ * Reads the writable private memory of the process, in bytes, from /proc/self/status. Reserved but uncommitted pages
+ * are not counted. Returns 0 if it cannot be read.
+ */
+size_t read_vm_data()
+{
+    FILE *status = fopen("/proc/self/status", "r");
+    if (status == NULL)
+        return 0;
+
+    char line[256];
+    size_t kib = 0;
+    while (fgets(line, sizeof(line), status) != NULL)
+    {
+        if (sscanf(line, "VmData: %zu kB", &kib) == 1)
+            break;
+    }
+    fclose(status);
+    return kib << 10;
+}
+
+/*
+ * This function checks that a pool far larger than the memory of the machine can be initialized and used, as only the
+ * part of it that is reached gets committed. A second round runs after the untouched tails were handed to the engine,
+ * with blocks that do not fit the freed ones, so the engine has to grow past what was committed; it must not commit the
+ * rest of the pool to do so.
+ */
+void test_reserved_pool_multithread(TestParams params)
+{
+    printf_yellow("  Testing \"reserved pool\" (threads: %d, blocks: %d, block_size: %zu, memory_size: %zu GiB) ---> ", params.num_threads, params.num_blocks, params.block_size, params.memory_size >> 30);
+
+    pthread_t threads[params.num_threads];
+    thread_data_t params_t[params.num_threads];
+
+    mem_init(params.memory_size);
+
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        params_t[i].thread_id = i;
+        params_t[i].num_blocks = params.num_blocks;
+        params_t[i].block_size = params.block_size;
+        params_t[i].block_pointers = malloc(params.num_blocks * sizeof(void *));
+        pthread_create(&threads[i], NULL, thread_reserved_pool, &params_t[i]);
+    }
+
+    int failures = 0;
+    void *status;
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        pthread_join(threads[i], &status);
+        failures += (long)status;
+    }
+
+    // Compaction hands the tail of every arena to the engine
+    size_t before = read_vm_data();
+    mem_handle_t *handle = mem_halloc(64);
+    mem_compact();
+    mem_hfree(handle);
+
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        params_t[i].block_size = params.block_size * 2;
+        pthread_create(&threads[i], NULL, thread_reserved_pool, &params_t[i]);
+    }
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        pthread_join(threads[i], &status);
+        failures += (long)status;
+        free(params_t[i].block_pointers);
+    }
+    size_t growth = read_vm_data() - before;
+
+    mem_deinit();
+
+    if (failures == 0 && growth < params.memory_size / 4)
+    {
+        printf_green("[PASS].\n");
+    }
+    else if (failures != 0)
+    {
+        printf_red("[FAIL]: %d allocations failed.\n", failures);
+    }
+    else
+    {
+        printf_red("[FAIL]: %zu MiB were committed after the tails were absorbed.\n", growth >> 20);
+    }
+}
+
+/*
+ * This function checks that pools backed by huge pages start on a 2 MiB boundary and are usable to the last byte.
+ * Explicit huge pages are usually not reserved, so MEM_PAGES_HUGETLB is expected to fall back to an aligned mapping.
+ */
+void test_huge_page_pool(mem_pages_t pages, const char *name)
+{
+    printf_yellow("  Testing \"%s pages\" ---> ", name);
+
+    size_t mem_size = (5 << 20) + 12345;
+    mem_init_config(mem_size, &(mem_config_t){.pages = pages});
+
+    // The first block of an empty pool starts at its base
+    char *block = mem_alloc(mem_size);
+    bool aligned = block != NULL && (uintptr_t)block % (2 << 20) == 0;
+    if (block != NULL)
+    {
+        memset(block, 0x5a, mem_size);
+        sanityCheck(mem_size, block, 0x5a);
+        mem_free(block);
+    }
+    mem_deinit();
+
+    if (aligned)
+    {
+        printf_green("[PASS].\n");
+    }
+    else
+    {
+        printf_red("[FAIL]: The pool %s.\n", block == NULL ? "could not be used whole" : "is not aligned to 2 MiB");
+    }
+}
+
+void *repeated_allocate_and_free(void *arg)
+{
+    thread_data_t *data = (thread_data_t *)arg;
+    int cycles = data->iterations; // Use iterations from thread data for number of cycles
+
+    for (int i = 0; i < cycles; i++)
+    {
+        void *block = mem_alloc(data->block_size); // Allocate using the block_size from thread data
+        if (block == NULL)
+        {
+            if (debug)
+                printf_red("    Thread %d failed to allocate %zu bytes\n", data->thread_id, data->block_size);
+            continue; // Skip freeing and proceed to the next cycle
+        }
+        if (debug)
+            printf_yellow("    Thread %d allocated and will now free %zu bytes\n", data->thread_id, data->block_size);
+        my_barrier_wait(&barrier); // Synchronize after allocation
+
+        mem_free(block); // Free the block to create fragmentation
+
+        my_barrier_wait(&barrier); // Synchronize after free
+    }
+
+    return NULL;
+}
+
+// Function for threads to attempt allocation in the fragmented memory
+void *repeated_allocate_in_fragment(void *arg)
+{
+    thread_data_t *data = (thread_data_t *)arg;
+    int cycles = data->iterations; // Number of allocation attempts per thread
+
+    for (int i = 0; i < cycles; i++)
+    {
+        my_barrier_wait(&barrier); // Wait until fragmentation is created
+
+        // Attempt to allocate in the fragmented space
+        void *block = mem_alloc(data->block_size);
+        if (block != NULL)
+        {
+            if (debug)
+                printf_yellow("    Thread %d allocated %zu bytes in fragmented memory\n", data->thread_id, data->block_size);
+            mem_free(block);
+        }
+        else
+        {
+            if (debug)
+                printf_red("    Thread %d failed to allocate %zu bytes in fragmented memory\n", data->thread_id, data->block_size);
+        }
+
+        my_barrier_wait(&barrier); // Synchronize before the next cycle
+    }
+
+    return NULL;
+}
+
+void test_memory_fragmentation_multithread(TestParams params)
+{
+    printf_yellow("  Testing \"memory fragmentation handling\" (threads: %d, mem_size: %zu, iterations: %d) ---> ", params.num_threads, params.memory_size, params.iterations);
+    mem_init(params.memory_size); // Initialize with specified memory size to accommodate load
+
+    pthread_t threads[params.num_threads];
+    thread_data_t params_t[params.num_threads]; // Array of thread data
+
+    my_barrier_init(&barrier, params.num_threads); // Initialize the barrier
+
+    // Dynamically calculate block size based on available memory and the number of threads
+    size_t base_block_size = params.memory_size / (params.num_threads * 3); // Adjust factor if necessary to prevent over-allocation
+
+    // Setup thread parameters
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        params_t[i].thread_id = i;
+        params_t[i].block_size = base_block_size * (i % 3 + 1); // Multiplicative factor to vary block size: 1x, 2x, 3x
+        params_t[i].iterations = params.iterations;             // Set the number of allocation-free cycles
+
+        if (i % 2 == 0)
+        {
+            // Even-indexed threads create fragmentation
+            pthread_create(&threads[i], NULL, repeated_allocate_and_free, &params_t[i]);
+        }
+        else
+        {
+            // Odd-indexed threads attempt to fill fragmented spaces
+            pthread_create(&threads[i], NULL, repeated_allocate_in_fragment, &params_t[i]);
+        }
+    }
+
+    // Wait for all threads to finish
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    mem_deinit(); // Clean up the memory manager
+    my_barrier_destroy(&barrier);
+    printf_green("[PASS].\n");
+}
+
+void *thread_function(void *arg)
+{
+    thread_data_t *params = (thread_data_t *)arg;
+    int thread_id = params->thread_id;
+    int num_allocations = params->num_blocks;
+    size_t block_size = params->block_size;
+
+    char **blocks = (char **)malloc(num_allocations * sizeof(char *));
+    my_assert(blocks != NULL); // Check that allocation was successful
+    size_t sizes[params->batch_size + 1];
+    for (int i = 0; i < params->batch_size; i++)
+        sizes[i] = block_size;
+
+    for (int i = 0; i < num_allocations; i++)
+    {
+        // Allocate memory, a batch at a time if batches are used
+        if (params->batch_size == 0)
+        {
+            blocks[i] = (char *)mem_alloc(block_size);
+        }
+        else if (i % params->batch_size == 0)
+        {
+            int count = num_allocations - i < params->batch_size ? num_allocations - i : params->batch_size;
+            my_assert(mem_alloc_batch(sizes, count, (void **)&blocks[i]));
+        }
+        my_assert(blocks[i] != NULL); // Check allocation was successful
+        // printf("Thread %d: Allocated block %d at %p = %d\n", thread_id, i, blocks[i], thread_id * num_allocations + i);
+        // Write a unique pattern based on thread_id and index i
+        memset(blocks[i], thread_id * num_allocations + i, block_size);
+
+        // Optionally, simulate some work or delay
+        if (params->simulate_work)
+            usleep(rand() % 1000);
+    }
+
+    // my_barrier_wait(&barrier);
+
+    for (int i = 0; i < num_allocations; i++)
+    {
+        sanityCheck(block_size, blocks[i], (char)(thread_id * num_allocations + i));
+    }
+
+    // Free memory
+    if (params->batch_size == 0)
+    {
+        for (int i = 0; i < num_allocations; i++)
+            mem_free(blocks[i]);
+    }
+    else
+    {
+        for (int i = 0; i < num_allocations; i += params->batch_size)
+            mem_free_batch((void **)&blocks[i], num_allocations - i < params->batch_size ? num_allocations - i : params->batch_size);
+    }
+    // Free the dynamically allocated array of pointers
+    free(blocks);
+
+    return NULL;
+}
+
+void run_concurrency_test(TestParams params)
+{
+    printf_yellow("  Running concurrency test with %d threads, %d allocations per thread, and block size %zu bytes", params.num_threads, params.num_blocks / params.num_threads, params.block_size);
+    if (params.batch_size)
+        printf_yellow(" in batches of %d", params.batch_size);
+    printf_yellow(" --> ");
+    struct timeval start_time, end_time;
+    gettimeofday(&start_time, NULL); // Start timing
+    pthread_t threads[params.num_threads];
+    thread_data_t params_t[params.num_threads];
+    my_barrier_init(&barrier, params.num_threads);
+    // Initialize your memory manager here
+    mem_init(params.num_blocks * params.block_size); // Initialize with enough memory for the test
+
+    // Create multiple threads to perform memory operations
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        params_t[i].thread_id = i;
+        params_t[i].num_blocks = params.num_blocks / params.num_threads;
+        params_t[i].block_size = params.block_size;
+        params_t[i].simulate_work = params.simulate_work;
+        params_t[i].batch_size = params.batch_size;
+        pthread_create(&threads[i], NULL, thread_function, &params_t[i]);
+    }
+
+    // Join all threads
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    // Clean up the memory manager here if needed
+    mem_deinit();
+
+    gettimeofday(&end_time, NULL); // End timing
+    my_barrier_destroy(&barrier);  // Destroy the barrier
+    // Calculate elapsed time
+    long seconds = end_time.tv_sec - start_time.tv_sec;
+    long micros = ((seconds * 1000000) + end_time.tv_usec) - (start_time.tv_usec);
+    printf_yellow("Time: %ld microseconds.\t", micros);
+
+    printf_green("[PASS].\n");
+}
+
+/* Latency benchmark for the allocation engines */
+
+int compare_long(const void *a, const void *b)
+{
+    long x = *(const long *)a;
+    long y = *(const long *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * This function measures the mem_alloc latency distribution of an engine for a given number of live blocks.
+ * The pool is fragmented first by allocating small and large blocks in turn and freeing the small ones, so every hole is smaller than the requests.
+ * Each sample times a single mem_alloc of a random size; the block is freed again outside the timed region.
+ */
+void benchmark_alloc_latency(mem_engine_t engine, const char *engine_name, int live_blocks, int samples)
+{
+    int total_blocks = 2 * live_blocks;
+    size_t mem_size = (size_t)total_blocks * 1024;
+    void **blocks = malloc(total_blocks * sizeof(void *));
+    long *latencies = malloc(samples * sizeof(long));
+    struct timespec start_time, end_time;
+
+    // Every sample goes through the engine, not the untouched tail, a tiny run or a cache
+    mem_init_config(mem_size, &(mem_config_t){.engine = engine, .engineOnly = true});
+    srand(42);
+
+    for (int i = 0; i < total_blocks; i++)
+        blocks[i] = mem_alloc(i % 2 == 0 ? 16 + rand() % 48 : 64 + rand() % 960);
+    for (int i = 0; i < total_blocks; i += 2)
+        mem_free(blocks[i]);
+
+    for (int i = 0; i < samples; i++)
+    {
+        size_t size = 64 + rand() % 960;
+        clock_gettime(CLOCK_MONOTONIC, &start_time);
+        void *block = mem_alloc(size);
+        clock_gettime(CLOCK_MONOTONIC, &end_time);
+        my_assert(block != NULL);
+        mem_free(block);
+        latencies[i] = (end_time.tv_sec - start_time.tv_sec) * 1000000000L + (end_time.tv_nsec - start_time.tv_nsec);
+    }
+
+    qsort(latencies, samples, sizeof(long), compare_long);
+    printf_yellow("  %-5s live blocks: %7d  p50: %7ld ns  p99: %7ld ns  p99.9: %7ld ns  max: %7ld ns\n", engine_name, live_blocks,
+                  latencies[samples / 2], latencies[samples * 99 / 100], latencies[samples * 999 / 1000], latencies[samples - 1]);
+
+    mem_deinit();
+    free(latencies);
+    free(blocks);
+}
+
+/*
+ * This function compares a placement policy of the list engine on fragmentation and throughput.
+ * Throughput is the wall time of the fragmentation and repeated fit reuse workloads.
+ * Fragmentation is measured after a random churn of alloc and free calls, as the share of free memory outside the largest free block.
+ */
+void benchmark_placement_policy(mem_policy_t policy, const char *policy_name, int iterations)
+{
+    struct timespec start_time, end_time;
+    size_t mem_size = 256 * 1024;
+    void *blocks[256] = {NULL};
+    size_t sizes[256] = {0};
+    size_t live = 0;
+    int failures = 0;
+
+    mem_set_policy(policy);
+    printf("  %s fit:\n", policy_name);
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    test_memory_fragmentation_multithread((TestParams){.num_threads = 4, .memory_size = 2048, .iterations = iterations});
+    test_repeated_fit_reuse_multithread((TestParams){.num_threads = 4, .memory_size = 1024, .iterations = iterations * 10});
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    long micros = (end_time.tv_sec - start_time.tv_sec) * 1000000L + (end_time.tv_nsec - start_time.tv_nsec) / 1000;
+
+    mem_init_config(mem_size, &(mem_config_t){.engine = MEM_ENGINE_LIST});
+    srand(42);
+    for (int i = 0; i < iterations * 10; i++)
+    {
+        int slot = rand() % 256;
+        if (blocks[slot] != NULL)
+        {
+            mem_free(blocks[slot]);
+            live -= sizes[slot];
+            blocks[slot] = NULL;
+            continue;
+        }
+        sizes[slot] = 300 + rand() % 2048;
+        blocks[slot] = mem_alloc(sizes[slot]);
+        if (blocks[slot] == NULL)
+            failures++;
+        else
+            live += sizes[slot];
+    }
+
+    // Find the largest block that still fits with a binary search
+    size_t lo = 0;
+    size_t hi = mem_size - live;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo + 1) / 2;
+        void *block = mem_alloc(mid);
+        if (block != NULL)
+        {
+            mem_free(block);
+            lo = mid;
+        }
+        else
+        {
+            hi = mid - 1;
+        }
+    }
+    size_t free_bytes = mem_size - live;
+    mem_deinit();
+
+    printf_yellow("  %-5s time: %8ld us  failed allocations: %5d  free: %6zu  largest free block: %6zu  fragmentation: %5.1f%%\n",
+                  policy_name, micros, failures, free_bytes, lo, free_bytes ? 100.0 * (free_bytes - lo) / free_bytes : 0.0);
+}
+
+/* repeated from A1, as there were solutions that has issues */
+
+void test_looking_for_out_of_bounds()
+{
+    printf("  Testing outofbounds (errors not tracked/detected here) \n");
+
+    printf("ALLOCATION 5000\n");
+    mem_init(5000); // Initialize with 1024 bytes
+    printf("ALLOCATED 5000\n");
     void *block0 = mem_alloc(512); // Edge case: zero allocation
     assert(block0 != NULL);        // Depending on handling, this could also be NULL
 
@@ -904,7 +3246,9 @@ int main(int argc, char *argv[])
         printf("  0. tests various functions with a base number of threads\n");
         printf("  1. tests various functions across variious configurations (number of threads, memory sizes,  iterations)\n");
         printf("  2. stress tests various functions with various configurations. This may take some time (especially if simulate_work flag is set to true.\n");
-        printf("  3. test_looking_for_out_of_bounds, needs LD_PRELOAD=./libmymalloc.so .\n\n");
+        printf("  3. test_looking_for_out_of_bounds, needs LD_PRELOAD=./libmymalloc.so .\n");
+        printf("  4. benchmarks mem_alloc latency percentiles of each engine as the number of live blocks grows.\n");
+        printf("  5. compares the placement policies of the list engine on fragmentation and throughput.\n\n");
         return 1;
     }
 
@@ -926,6 +3270,7 @@ int main(int argc, char *argv[])
         run_concurrent_test(test_zero_alloc_and_free, (TestParams){.num_threads = base_num_threads, .memory_size = 1024}, "zero alloc and free");
 
         test_resize_multithread((TestParams){.num_threads = base_num_threads});
+        test_resize_in_place_multithread((TestParams){.num_threads = base_num_threads, .block_size = 512, .iterations = 100});
 
         test_exceed_single_allocation_multithread((TestParams){.num_threads = base_num_threads});
         test_exceed_cumulative_allocation_multithread((TestParams){.num_threads = base_num_threads, .memory_size = 1024}); // TODO: Fix this to be able to run with various configurations
@@ -937,6 +3282,45 @@ int main(int argc, char *argv[])
 
         test_memory_fragmentation_multithread((TestParams){.num_threads = base_num_threads, .memory_size = 2048});
         test_random_blocks_multithread((TestParams){.num_threads = base_num_threads, .block_size = 1024});
+        test_size_class_reuse_multithread((TestParams){.num_threads = base_num_threads, .memory_size = 1024, .iterations = 1000});
+        test_free_out_of_order_multithread((TestParams){.num_threads = base_num_threads, .num_blocks = 4096, .block_size = 300});
+
+        for (int i = 0; i < 4; i++)
+            test_buddy_power_of_two_multithread((TestParams){.num_threads = base_num_threads, .memory_size = 1024 << i});
+
+        test_object_cache_multithread((TestParams){.num_threads = base_num_threads, .num_blocks = 1000});
+        test_thread_cache_flush_multithread((TestParams){.num_threads = base_num_threads, .num_blocks = 8, .block_size = 64});
+
+        test_arenas_multithread((TestParams){.num_threads = base_num_threads, .memory_size = 64 * 1024, .num_blocks = 4}, MEM_ENGINE_LIST, "list");
+        test_arenas_multithread((TestParams){.num_threads = base_num_threads, .memory_size = 64 * 1024, .num_blocks = 4}, MEM_ENGINE_TLSF, "tlsf");
+        test_arenas_multithread((TestParams){.num_threads = base_num_threads, .memory_size = 64 * 1024, .num_blocks = 4}, MEM_ENGINE_BUDDY, "buddy");
+        test_bump_tail_multithread((TestParams){.num_threads = base_num_threads, .num_blocks = 200, .block_size = 48});
+        test_tiny_blocks_multithread((TestParams){.num_threads = base_num_threads, .num_blocks = 400});
+        test_placement_policies();
+        test_best_fit_churn_multithread((TestParams){.num_threads = base_num_threads, .num_blocks = 64, .block_size = 1024, .iterations = 20000});
+        test_huge_page_pool(MEM_PAGES_HUGE, "huge");
+        test_huge_page_pool(MEM_PAGES_HUGETLB, "hugetlb");
+        test_handle_compaction_multithread((TestParams){.num_threads = base_num_threads, .num_blocks = 64, .block_size = 512, .iterations = 200});
+        test_trim_multithread((TestParams){.num_threads = base_num_threads, .num_blocks = 64, .block_size = 16384}, 0);
+        test_trim_multithread((TestParams){.num_threads = base_num_threads, .num_blocks = 64, .block_size = 16384}, 65536);
+        test_reserved_pool_multithread((TestParams){.num_threads = base_num_threads, .num_blocks = 16, .block_size = 1 << 20, .memory_size = 16UL << 30});
+        test_pool_growth_multithread((TestParams){.num_threads = base_num_threads, .memory_size = 64 * 1024, .block_size = 4096}, MEM_ENGINE_LIST, "list");
+        test_pool_growth_multithread((TestParams){.num_threads = base_num_threads, .memory_size = 64 * 1024, .block_size = 4096}, MEM_ENGINE_TLSF, "tlsf");
+        test_pool_growth_multithread((TestParams){.num_threads = base_num_threads, .memory_size = 64 * 1024, .block_size = 4096}, MEM_ENGINE_BUDDY, "buddy");
+        test_pools_multithread((TestParams){.num_threads = base_num_threads, .memory_size = 64 * 1024, .block_size = 1024});
+        test_aligned_alloc_multithread((TestParams){.num_threads = base_num_threads, .memory_size = 256 * 1024, .num_blocks = 32, .block_size = 200}, MEM_ENGINE_LIST, "list", 0);
+        test_aligned_alloc_multithread((TestParams){.num_threads = base_num_threads, .memory_size = 256 * 1024, .num_blocks = 32, .block_size = 200}, MEM_ENGINE_TLSF, "tlsf", 0);
+        test_aligned_alloc_multithread((TestParams){.num_threads = base_num_threads, .memory_size = 256 * 1024, .num_blocks = 32, .block_size = 200}, MEM_ENGINE_BUDDY, "buddy", 0);
+        test_aligned_alloc_multithread((TestParams){.num_threads = base_num_threads, .memory_size = 256 * 1024, .num_blocks = 32, .block_size = 200}, MEM_ENGINE_LIST, "list", 64);
+        test_batch_multithread((TestParams){.num_threads = base_num_threads, .memory_size = 1024 * 1024, .num_blocks = 256, .block_size = 64, .iterations = 32}, MEM_ENGINE_LIST, "list");
+        test_batch_multithread((TestParams){.num_threads = base_num_threads, .memory_size = 1024 * 1024, .num_blocks = 256, .block_size = 64, .iterations = 32}, MEM_ENGINE_TLSF, "tlsf");
+        test_batch_multithread((TestParams){.num_threads = base_num_threads, .memory_size = 1024 * 1024, .num_blocks = 256, .block_size = 64, .iterations = 32}, MEM_ENGINE_BUDDY, "buddy");
+        test_remote_free_multithread((TestParams){.num_threads = base_num_threads, .memory_size = 64 * 1024, .num_blocks = 4096, .block_size = 1024, .iterations = 1});
+        test_remote_free_multithread((TestParams){.num_threads = base_num_threads, .memory_size = 64 * 1024, .num_blocks = 4096, .block_size = 1024, .iterations = 4});
+        test_cpu_caches_multithread((TestParams){.num_threads = 16 * base_num_threads, .num_blocks = 16, .block_size = 64, .iterations = 100});
+        test_numa_arenas_multithread((TestParams){.num_threads = base_num_threads, .memory_size = 1024 * 1024, .block_size = 256});
+        test_region_multithread((TestParams){.num_threads = base_num_threads, .memory_size = 1024 * 1024, .num_blocks = 64, .block_size = 64, .iterations = 100});
+        test_reset_multithread((TestParams){.num_threads = base_num_threads, .memory_size = 256 * 1024, .num_blocks = 64, .block_size = 2048, .iterations = 10});
 
         break;
 
@@ -980,6 +3364,10 @@ int main(int argc, char *argv[])
         printf("Testing large number of blocks of fixed size\n");
         for (int i = 0; i < 9; i++)
             run_concurrency_test((TestParams){.num_threads = pow(2, i), .num_blocks = allocs, .block_size = blockSize, .simulate_work = simulate_work});
+
+        printf("Testing large number of blocks of fixed size in batches\n");
+        for (int i = 0; i < 9; i++)
+            run_concurrency_test((TestParams){.num_threads = pow(2, i), .num_blocks = allocs, .block_size = blockSize, .simulate_work = simulate_work, .batch_size = 32});
         break;
 
     case 3:
@@ -987,6 +3375,25 @@ int main(int argc, char *argv[])
         test_looking_for_out_of_bounds();
         break;
 
+    case 4:
+        printf("\n*** Latency benchmark: ***\n");
+        for (int live_blocks = 1000; live_blocks <= 32000; live_blocks *= 2)
+        {
+            benchmark_alloc_latency(MEM_ENGINE_LIST, "list", live_blocks, 20000);
+            benchmark_alloc_latency(MEM_ENGINE_TLSF, "tlsf", live_blocks, 20000);
+            benchmark_alloc_latency(MEM_ENGINE_BUDDY, "buddy", live_blocks, 20000);
+        }
+        break;
+
+    case 5:
+        printf("\n*** Placement policy comparison: ***\n");
+        benchmark_placement_policy(MEM_POLICY_FIRST_FIT, "first", 1000);
+        benchmark_placement_policy(MEM_POLICY_NEXT_FIT, "next", 1000);
+        benchmark_placement_policy(MEM_POLICY_BEST_FIT, "best", 1000);
+        benchmark_placement_policy(MEM_POLICY_WORST_FIT, "worst", 1000);
+        mem_set_policy(MEM_POLICY_FIRST_FIT);
+        break;
+
     default:
         printf("Invalid test function\n");
         break;